@@ -1,98 +1,452 @@
 #include "back/compiler/compiler.h"
 
+#include <cstdint>
+#include <cassert>
+
+#include "back/compiler/uncurry.h"
+#include "back/compiler/passes.h"
+#include "back/compiler/lowering.h"
+#include "define/intern.h"
+
 using namespace ionia;
 
+void Compiler::InitPasses() {
+  passes_.RegisterPass<ir::DeadCodePass>();
+  passes_.RegisterPass<ir::TailCallPass>();
+}
+
 std::string Compiler::GetNextLabel() {
   return ":func-" + std::to_string(label_id_++);
 }
 
+ir::ValueId Compiler::Build(const ASTPtr &ast) {
+  ast->Compile(*this);
+  return value_;
+}
+
 void Compiler::GenerateAllFuncDefs() {
   while (!func_defs_.empty()) {
-    const auto &func = func_defs_.front();
-    // generate label
-    gen_.LABEL(func.label);
-    // generate prologue
-    for (const auto &i : func.args) {
-      gen_.POP();
-      gen_.SET(i);
+    auto &func = func_defs_.front();
+    // create IR function
+    std::uint32_t arg_count = func.args.size();
+    const auto &name = GetIdName(func.name);
+    module_.funcs.push_back({func.label, name, arg_count, 0, {}, 0});
+    cur_func_ = &module_.funcs.back();
+    // create scope, arguments are stored in the first slots by VM
+    cur_scope_ = std::make_unique<Scope>();
+    cur_scope_->name = name.empty() ? func.label : name;
+    cur_scope_->label = func.label;
+    cur_scope_->self = func.self;
+    cur_scope_->vars = &func.vars;
+    cur_scope_->captures = std::move(func.captures);
+    cur_scope_->slot_count = arg_count;
+    for (std::uint32_t i = 0; i < arg_count; ++i) {
+      cur_scope_->locals[func.args[i]] = {i, false, true};
     }
-    // generate body
-    func.expr->Compile(*this);
-    // generate return
-    gen_.GenReturn();
-    // check if is global function
-    if (func.name[0] == '$') {
-      gen_.RegisterGlobalFunction(func.name, func.label, func.args.size());
+    for (const auto &i : func.vars.locals) {
+      auto it = cur_scope_->locals.find(i);
+      if (it == cur_scope_->locals.end()) {
+        auto slot = VarSlot({cur_scope_->slot_count++, false, false});
+        it = cur_scope_->locals.insert({i, slot}).first;
+      }
+      // variables that may be changed after being captured must be boxed
+      if (func.vars.captured.count(i) && func.vars.defines.count(i)) {
+        it->second.boxed = true;
+        cur_func_->Add(ir::Op::Box, {}, it->second.index);
+      }
     }
+    cur_scope_->used_slots = cur_scope_->slot_count;
+    // build body and return
+    cur_func_->Add(ir::Op::Return, {Build(func.expr)});
+    cur_func_->slot_count = cur_scope_->slot_count;
+    cur_scope_ = nullptr;
+    cur_func_ = &module_.main;
     func_defs_.pop_front();
   }
 }
 
-std::vector<std::uint8_t> Compiler::GenerateBytecode() {
-  // generate RET instruction
-  gen_.RET();
-  // generate all function definitions
+Compiler::VarKind Compiler::FindVar(SymId id, VarSlot &slot) {
+  if (!cur_scope_) return VarKind::Global;
+  // inlined function can only refer to its local variables and globals
+  if (!cur_scope_->inlines.empty()) {
+    const auto &locals = cur_scope_->inlines.back();
+    auto it = locals.find(id);
+    if (it == locals.end()) return VarKind::Global;
+    slot = it->second;
+    return VarKind::Local;
+  }
+  // find in local variables
+  auto it = cur_scope_->locals.find(id);
+  if (it != cur_scope_->locals.end()) {
+    slot = it->second;
+    return VarKind::Local;
+  }
+  return FindOuterVar(id, slot);
+}
+
+Compiler::VarKind Compiler::FindOuterVar(SymId id, VarSlot &slot) {
+  if (!cur_scope_ || !cur_scope_->inlines.empty()) return VarKind::Global;
+  // find in captured values
+  auto it = cur_scope_->captures.find(id);
+  if (it != cur_scope_->captures.end()) {
+    slot = it->second;
+    return VarKind::Captured;
+  }
+  // check if is the lifted function itself
+  if (id == cur_scope_->self) return VarKind::Self;
+  return VarKind::Global;
+}
+
+void Compiler::CompileProgram() {
+  // program will be kept until reset since definitions in it
+  // are referenced by 'globals_'
+  cur_func_ = &module_.main;
+  for (const auto &i : program_) Build(i);
+  cur_func_->Add(ir::Op::Return);
+}
+
+void Compiler::CompileAll() {
+  // build IR of all statements and function definitions
+  CompileProgram();
   GenerateAllFuncDefs();
-  // generate bytecode
-  return gen_.GenerateBytecode();
+  gen_.set_mode(mode_);
+  if (!LowerModule()) {
+    // program does not fit in operands of register-based instructions,
+    // fall back to stack mode, which has no such limits
+    gen_.Reset();
+    gen_.set_mode(vm::CodeMode::Stack);
+    ir::Lowering lowering(gen_);
+    lowering.LowerModule(module_);
+  }
+}
+
+bool Compiler::LowerModule() {
+  // run passes
+  passes_.Run(module_);
+  if (ir_dump_) ir::DumpModule(*ir_dump_, module_);
+  // lower to bytecode
+  ir::Lowering lowering(gen_);
+  return lowering.LowerModule(module_);
+}
+
+bool Compiler::CompileUncurriedCall(const ASTPtr &callee,
+                                    const ASTPtrList &args) {
+  // get the innermost callee
+  std::vector<const ASTPtrList *> arg_lists;
+  auto &func = FlattenCallChain(callee, args, arg_lists);
+  auto id = dynamic_cast<const IdAST *>(func.get());
+  if (!id) return false;
+  VarSlot slot;
+  if (FindVar(id->id(), slot) != VarKind::Global) return false;
+  // check if callee is a known curried function
+  auto known = globals_.GetKnownFunc(id->id());
+  CurriedFunc curried;
+  if (!known || !AnalyzeCurriedFunc(*known, curried)) return false;
+  // check if call is saturated
+  auto level = curried.arities.size();
+  if (arg_lists.size() < level) return false;
+  for (std::size_t i = 0; i < level; ++i) {
+    if (arg_lists[i]->size() != curried.arities[i]) return false;
+  }
+  // get uncurried entry, which is always a closed function
+  auto it = uncurried_.find(id->id());
+  if (it == uncurried_.end()) {
+    auto label = GetNextLabel();
+    const auto &body = *curried.body;
+    auto vars = AnalyzeFuncVars(curried.args, body);
+    func_defs_.emplace_back(FuncDefInfo({label, kNoId, curried.args,
+                                         body, std::move(vars),
+                                         {}, kNoId}));
+    it = uncurried_.insert({id->id(), label}).first;
+  }
+  // evaluate arguments in the same order as curried calls,
+  // arguments of outer calls are evaluated before their callees
+  std::vector<std::vector<ir::ValueId>> values(arg_lists.size());
+  for (auto i = arg_lists.size(); i; --i) {
+    for (const auto &arg : *arg_lists[i - 1]) {
+      values[i - 1].push_back(Build(arg));
+    }
+  }
+  // call uncurried entry with arguments of all saturated levels
+  std::vector<ir::ValueId> opers = {0};
+  for (std::size_t i = 0; i < level; ++i) {
+    opers.insert(opers.end(), values[i].begin(), values[i].end());
+  }
+  opers.front() = cur_func_->Add(ir::Op::FuncRef, {}, 0, it->second);
+  value_ = cur_func_->Add(ir::Op::Call, std::move(opers));
+  // call the rest levels, result of last call is the callee
+  for (auto i = level; i < arg_lists.size(); ++i) {
+    opers = {value_};
+    opers.insert(opers.end(), values[i].begin(), values[i].end());
+    value_ = cur_func_->Add(ir::Op::Call, std::move(opers));
+  }
+  return true;
+}
+
+bool Compiler::CompileInlineCall(const ASTPtr &callee,
+                                 const ASTPtrList &args) {
+  // arguments of inlined function are stored in frame slots,
+  // so there must be a frame
+  if (!cur_scope_) return false;
+  // check if callee is a global variable
+  auto id = dynamic_cast<const IdAST *>(callee.get());
+  VarSlot slot;
+  if (!id || FindVar(id->id(), slot) != VarKind::Global) return false;
+  // check if can be inlined
+  auto func = inliner_.CheckCall(id->id(), args.size(), cur_scope_->name);
+  if (!func) return false;
+  // allocate slots for all local variables of inlined function
+  const auto &params = func->args();
+  auto vars = AnalyzeFuncVars(params, func->expr());
+  auto base = cur_scope_->used_slots;
+  VarSlotMap locals;
+  for (std::uint32_t i = 0; i < params.size(); ++i) {
+    locals[params[i]] = {base + i, false, true};
+  }
+  auto used = base + static_cast<std::uint32_t>(params.size());
+  for (const auto &i : vars.locals) {
+    if (!locals.count(i)) locals[i] = {used++, false, false};
+  }
+  cur_scope_->used_slots = used;
+  if (used > cur_scope_->slot_count) cur_scope_->slot_count = used;
+  // evaluate arguments
+  for (std::size_t i = 0; i < args.size(); ++i) {
+    cur_func_->Add(ir::Op::StoreLocal, {Build(args[i])}, base + i);
+  }
+  // create boxes
+  for (const auto &i : vars.locals) {
+    if (vars.captured.count(i) && vars.defines.count(i)) {
+      auto &slot = locals[i];
+      slot.boxed = true;
+      cur_func_->Add(ir::Op::Box, {}, slot.index);
+    }
+  }
+  // build body
+  cur_scope_->inlines.push_back(std::move(locals));
+  inliner_.Enter(id->id());
+  Build(func->expr());
+  inliner_.Exit();
+  cur_scope_->inlines.pop_back();
+  // release slots
+  cur_scope_->used_slots = base;
+  return true;
+}
+
+bool Compiler::GetDirectCallee(const ASTPtr &callee, std::size_t arg_count,
+                               std::string &label) {
+  // check if callee is a global variable
+  auto id = dynamic_cast<const IdAST *>(callee.get());
+  VarSlot slot;
+  if (!id || FindVar(id->id(), slot) != VarKind::Global) return false;
+  // global function that is defined exactly once is always closed,
+  // its definition must have been compiled before, rebound builtin
+  // functions are never known since builtins count as a definition
+  auto func = globals_.GetKnownFunc(id->id());
+  if (!func || func->args().size() != arg_count) return false;
+  auto it = global_labels_.find(func);
+  if (it == global_labels_.end()) return false;
+  label = it->second;
+  return true;
+}
+
+vm::Program Compiler::GenerateProgram() {
+  CompileAll();
+  // generate program
+  return gen_.GenerateProgram();
 }
 
 void Compiler::GenerateBytecodeFile(const std::string &file) {
-  // generate RET instruction
-  gen_.RET();
-  // generate all function definitions
-  GenerateAllFuncDefs();
+  CompileAll();
   // generate bytecode
   gen_.GenerateBytecodeFile(file);
 }
 
 void Compiler::Reset() {
   gen_.Reset();
+  program_.clear();
+  globals_.Reset();
   func_defs_.clear();
+  uncurried_.clear();
+  global_labels_.clear();
+  inliner_.Reset();
   label_id_ = 0;
+  cur_scope_ = nullptr;
+  module_.main = {"", "", 0, 0, {}, 0};
+  module_.funcs.clear();
+  cur_func_ = &module_.main;
+  value_ = 0;
 }
 
 void Compiler::CompileNext(const ASTPtr &ast) {
-  ast->Compile(*this);
+  program_.push_back(ast);
+  globals_.AddStatement(program_.back());
+}
+
+bool Compiler::CompileIncremental(const ASTPtr &ast,
+                                  std::uint32_t &entry) {
+  // global variables may be redefined by the following statements,
+  // so statement is not added to 'globals_', and no global function
+  // is known, functions of previous statements are called by value
+  module_.main = {"", "", 0, 0, {}, 0};
+  module_.funcs.clear();
+  cur_func_ = &module_.main;
+  cur_func_->Add(ir::Op::Return, {Build(ast)});
+  GenerateAllFuncDefs();
+  // append to the end of previous code, previous code has been
+  // generated in current mode, so there is no way to fall back
+  auto begin = gen_.BeginSegment();
+  if (!LowerModule()) {
+    gen_.DiscardSegment(begin);
+    return false;
+  }
+  gen_.FinishSegment(begin);
+  entry = begin;
+  return true;
 }
 
-void Compiler::CompileId(const std::string &id) {
-  gen_.SmartGet(id);
+void Compiler::CompileId(SymId id) {
+  VarSlot slot;
+  auto kind = FindVar(id, slot);
+  // local variable that has not been defined yet refers to outer one
+  if (kind == VarKind::Local && !slot.defined) {
+    kind = FindOuterVar(id, slot);
+  }
+  switch (kind) {
+    case VarKind::Local: {
+      value_ = cur_func_->Add(ir::Op::LoadLocal, {}, slot.index);
+      if (slot.boxed) value_ = cur_func_->Add(ir::Op::Unbox, {value_});
+      break;
+    }
+    case VarKind::Captured: {
+      value_ = cur_func_->Add(ir::Op::LoadCaptured, {}, slot.index);
+      if (slot.boxed) value_ = cur_func_->Add(ir::Op::Unbox, {value_});
+      break;
+    }
+    case VarKind::Self: {
+      value_ = cur_func_->Add(ir::Op::FuncRef, {}, 0, cur_scope_->label);
+      break;
+    }
+    default: {
+      value_ = cur_func_->Add(ir::Op::LoadGlobal, {}, 0, GetIdName(id));
+      break;
+    }
+  }
 }
 
 void Compiler::CompileNum(int num) {
-  gen_.SetConst(num);
+  value_ = cur_func_->Add(ir::Op::Num, {}, num);
 }
 
-void Compiler::CompileDefine(const std::string &id, const ASTPtr &expr) {
-  auto last_func_def_len = func_defs_.size();
-  // generate definition
-  expr->Compile(*this);
-  // check if length of func def changed
-  if (func_defs_.size() != last_func_def_len) {
-    // record function name
-    func_defs_.back().name = id;
+void Compiler::CompileDefine(SymId id, const ASTPtr &expr) {
+  // build definition
+  if (auto func = dynamic_cast<const FuncAST *>(expr.get())) {
+    auto label = CompileFuncDef(id, func->args(), func->expr());
+    if (!cur_scope_) global_labels_[func] = label;
+  }
+  else {
+    expr->Compile(*this);
+  }
+  // build store
+  if (cur_scope_) {
+    // all definitions are analyzed as local variables
+    auto &locals = cur_scope_->inlines.empty() ? cur_scope_->locals
+                                               : cur_scope_->inlines.back();
+    auto &slot = locals.at(id);
+    auto op = slot.boxed ? ir::Op::StoreBox : ir::Op::StoreLocal;
+    value_ = cur_func_->Add(op, {value_}, slot.index);
+    slot.defined = true;
+  }
+  else {
+    value_ = cur_func_->Add(ir::Op::StoreGlobal, {value_}, 0,
+                            GetIdName(id));
   }
-  // generate SET instruction
-  gen_.SET(id);
 }
 
 void Compiler::CompileFunc(const IdList &args, const ASTPtr &expr) {
+  CompileFuncDef(kNoId, args, expr);
+}
+
+std::string Compiler::CompileFuncDef(SymId name, const IdList &args,
+                                     const ASTPtr &expr) {
   auto label = GetNextLabel();
+  auto vars = AnalyzeFuncVars(args, expr);
+  // check if function is only bound to 'name' in current scope,
+  // in this case, 'name' in function always refers to itself
+  auto is_self = cur_scope_ && cur_scope_->inlines.empty() &&
+                 cur_scope_->vars->defines.count(name) &&
+                 !cur_scope_->vars->redefines.count(name);
+  // find free variables that defined in current scope
+  struct FreeVar {
+    SymId id;
+    VarKind kind;
+    VarSlot slot;
+  };
+  std::vector<FreeVar> free_vars;
+  for (const auto &i : vars.free_vars) {
+    VarSlot slot;
+    auto kind = FindVar(i, slot);
+    if (kind != VarKind::Global) free_vars.push_back({i, kind, slot});
+  }
+  // closed functions are lifted to top level, so they can refer to
+  // themselves without capturing the local variable
+  SymId self = kNoId;
+  if (is_self && free_vars.size() == 1 && free_vars.front().id == name) {
+    free_vars.clear();
+    self = name;
+  }
+  // capture free variables, boxes are captured as is
+  VarSlotMap captures;
+  std::vector<ir::ValueId> values;
+  for (const auto &i : free_vars) {
+    switch (i.kind) {
+      case VarKind::Local: {
+        values.push_back(cur_func_->Add(ir::Op::LoadLocal, {},
+                                        i.slot.index));
+        break;
+      }
+      case VarKind::Captured: {
+        values.push_back(cur_func_->Add(ir::Op::LoadCaptured, {},
+                                        i.slot.index));
+        break;
+      }
+      case VarKind::Self: {
+        values.push_back(cur_func_->Add(ir::Op::FuncRef, {}, 0,
+                                        cur_scope_->label));
+        break;
+      }
+      default: assert(false);
+    }
+    auto index = static_cast<std::uint32_t>(captures.size());
+    auto boxed = i.kind != VarKind::Self && i.slot.boxed;
+    captures.insert({i.id, {index, boxed, true}});
+  }
   // record function definition
-  func_defs_.emplace_back(FuncDefInfo({label, "", args, expr->Clone()}));
-  // generate function value
-  gen_.GetFuncValue(label);
+  func_defs_.emplace_back(FuncDefInfo({label, name, args, expr,
+                                       std::move(vars), captures, self}));
+  // build function value, closed function is a known function
+  if (values.empty()) {
+    value_ = cur_func_->Add(ir::Op::FuncRef, {}, 0, label);
+  }
+  else {
+    value_ = cur_func_->Add(ir::Op::Closure, std::move(values), 0, label);
+  }
+  return label;
 }
 
 void Compiler::CompileFunCall(const ASTPtr &callee,
                               const ASTPtrList &args) {
-  // push all arguments
-  for (auto it = args.rbegin(); it != args.rend(); ++it) {
-    (*it)->Compile(*this);
-    gen_.PUSH();
-  }
-  // call function id
-  callee->Compile(*this);
-  gen_.CALL();
+  // try to call uncurried entry or inline the callee
+  if (CompileUncurriedCall(callee, args)) return;
+  if (CompileInlineCall(callee, args)) return;
+  // evaluate all arguments, then the callee
+  std::vector<ir::ValueId> opers = {0};
+  for (const auto &arg : args) opers.push_back(Build(arg));
+  std::string label;
+  if (GetDirectCallee(callee, args.size(), label)) {
+    opers.front() = cur_func_->Add(ir::Op::FuncRef, {}, 0, label);
+  }
+  else {
+    opers.front() = Build(callee);
+  }
+  value_ = cur_func_->Add(ir::Op::Call, std::move(opers));
 }
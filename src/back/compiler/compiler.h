@@ -4,50 +4,165 @@
 #include <string>
 #include <vector>
 #include <deque>
+#include <map>
+#include <memory>
+#include <ostream>
 #include <cstdint>
+#include <cstddef>
 
 #include "define/ast.h"
+#include "back/compiler/freevar.h"
+#include "back/compiler/globals.h"
+#include "back/compiler/inliner.h"
+#include "back/compiler/ir.h"
+#include "back/compiler/passman.h"
 #include "vm/codegen.h"
 
 namespace ionia {
 
+// compiler of Ionia, builds IR from AST, runs passes on IR,
+// and lowers IR to bytecode
 class Compiler {
  public:
-  Compiler() { Reset(); }
+  Compiler()
+      : mode_(vm::CodeMode::Stack), inliner_(globals_), ir_dump_(nullptr) {
+    InitPasses();
+    Reset();
+  }
 
-  // generate bytecode buffer
-  std::vector<std::uint8_t> GenerateBytecode();
+  // generate in-memory program that can be loaded by VM directly
+  vm::Program GenerateProgram();
   // generate bytecode file
   void GenerateBytecodeFile(const std::string &file);
   // reset compiler
   void Reset();
 
-  // compile next AST
+  // add next AST to program, program will be compiled
+  // when generating bytecode
   void CompileNext(const ASTPtr &ast);
+  // compile statement to bytecode immediately, the code is appended to
+  // code of previous statements, and its top level code returns value of
+  // the statement, 'entry' is set to the start position of top level
+  // code, returns false if code can not be generated in current mode
+  bool CompileIncremental(const ASTPtr &ast, std::uint32_t &entry);
 
   // visitor functions
-  void CompileId(const std::string &id);
+  void CompileId(SymId id);
   void CompileNum(int num);
-  void CompileDefine(const std::string &id, const ASTPtr &expr);
+  void CompileDefine(SymId id, const ASTPtr &expr);
   void CompileFunc(const IdList &args, const ASTPtr &expr);
   void CompileFunCall(const ASTPtr &callee, const ASTPtrList &args);
 
+  // setters
+  // set stream for dumping inlining decisions, 'nullptr' to disable
+  void set_inline_dump(std::ostream *dump) { inliner_.set_dump(dump); }
+  // set mode of generated bytecode
+  void set_code_mode(vm::CodeMode mode) {
+    mode_ = mode;
+    gen_.set_mode(mode);
+  }
+  // set stream for dumping IR, 'nullptr' to disable
+  void set_ir_dump(std::ostream *dump) { ir_dump_ = dump; }
+
+  // getters
+  // code generator that holds all incrementally compiled code
+  const vm::CodeGen &code_gen() const { return gen_; }
+
  private:
+  // kind of variable
+  enum class VarKind { Global, Local, Captured, Self };
+
+  // frame slot or captured value of variable
+  struct VarSlot {
+    std::uint32_t index;
+    // set if variable is stored in a box
+    bool boxed;
+    // set if variable has been defined at current point of function,
+    // identifier that read before its definition refers to global
+    bool defined;
+  };
+  using VarSlotMap = std::map<SymId, VarSlot>;
+
+  // scope of function
+  struct Scope {
+    // name of function, or label if function is anonymous
+    std::string name;
+    std::string label;
+    // name that refers to the lifted function itself
+    SymId self;
+    const FuncVarInfo *vars;
+    VarSlotMap locals;
+    VarSlotMap captures;
+    // variables of inlined functions, the last one is the innermost
+    std::vector<VarSlotMap> inlines;
+    // number of used slots, slots of inlined functions will be reused
+    std::uint32_t used_slots;
+    std::uint32_t slot_count;
+  };
+  using ScopePtr = std::unique_ptr<Scope>;
+
   struct FuncDefInfo {
     std::string label;
-    std::string name;
+    SymId name;
     IdList args;
     ASTPtr expr;
+    FuncVarInfo vars;
+    VarSlotMap captures;
+    SymId self;
   };
 
+  // register all passes on IR
+  void InitPasses();
   // return next label for function generation
   std::string GetNextLabel();
-  // generate all of function definitions in 'func_defs_'
+  // build IR of AST, returns the value of AST
+  ir::ValueId Build(const ASTPtr &ast);
+  // build IR of all statements in program
+  void CompileProgram();
+  // compile program and all function definitions
+  void CompileAll();
+  // run passes on IR and lower it to bytecode,
+  // returns false if lowering failed
+  bool LowerModule();
+  // build IR of all function definitions in 'func_defs_'
   void GenerateAllFuncDefs();
+  // find identifier in current scope
+  VarKind FindVar(SymId id, VarSlot &slot);
+  // find identifier in current scope, skipping local variables
+  VarKind FindOuterVar(SymId id, VarSlot &slot);
+  // compile function definition that bound to 'name', returns its label
+  std::string CompileFuncDef(SymId name, const IdList &args,
+                             const ASTPtr &expr);
+  // try to compile saturated call of known curried function,
+  // returns false if failed
+  bool CompileUncurriedCall(const ASTPtr &callee, const ASTPtrList &args);
+  // try to inline call of known function, returns false if failed
+  bool CompileInlineCall(const ASTPtr &callee, const ASTPtrList &args);
+  // get label of known global function that can be called directly,
+  // returns false if failed
+  bool GetDirectCallee(const ASTPtr &callee, std::size_t arg_count,
+                       std::string &label);
 
   vm::CodeGen gen_;
+  vm::CodeMode mode_;
+  ASTPtrList program_;
+  GlobalDefTable globals_;
   std::deque<FuncDefInfo> func_defs_;
+  // labels of uncurried entry of known curried functions
+  std::map<SymId, std::string> uncurried_;
+  // labels of compiled global function definitions
+  std::map<const FuncAST *, std::string> global_labels_;
+  Inliner inliner_;
   int label_id_;
+  // scope of current function, 'nullptr' if in global scope
+  ScopePtr cur_scope_;
+  // IR of program and function that is being built
+  ir::Module module_;
+  ir::Function *cur_func_;
+  // value of the last built AST
+  ir::ValueId value_;
+  ir::PassManager passes_;
+  std::ostream *ir_dump_;
 };
 
 }  // namespace ionia
@@ -0,0 +1,89 @@
+#include "back/compiler/freevar.h"
+
+#include <cassert>
+
+using namespace ionia;
+
+namespace {
+
+class VarCollector {
+ public:
+  VarCollector(FuncVarInfo &info) : info_(info) {}
+
+  void Collect(const ASTPtr &ast) {
+    if (auto id = dynamic_cast<const IdAST *>(ast.get())) {
+      AddRef(id->id());
+      // identifier that read before its definition refers to
+      // the variable in outer scope
+      if (!info_.defines.count(id->id())) early_refs_.insert(id->id());
+    }
+    else if (auto def = dynamic_cast<const DefineAST *>(ast.get())) {
+      // expression is evaluated before definition
+      Collect(def->expr());
+      if (info_.defines.insert(def->id()).second) {
+        defs_.push_back(def->id());
+      }
+      else {
+        info_.redefines.insert(def->id());
+      }
+    }
+    else if (auto func = dynamic_cast<const FuncAST *>(ast.get())) {
+      // free variables of inner function are referenced by current one
+      auto inner = AnalyzeFuncVars(func->args(), func->expr());
+      for (const auto &i : inner.free_vars) {
+        AddRef(i);
+        captured_.insert(i);
+      }
+    }
+    else if (auto call = dynamic_cast<const FunCallAST *>(ast.get())) {
+      Collect(call->callee());
+      for (const auto &i : call->args()) Collect(i);
+    }
+    else {
+      assert(dynamic_cast<const NumAST *>(ast.get()));
+    }
+  }
+
+  void Finish(const IdList &args) {
+    // collect local variables
+    std::set<SymId> locals;
+    for (const auto &i : args) {
+      if (locals.insert(i).second) info_.locals.push_back(i);
+      if (info_.defines.count(i)) info_.redefines.insert(i);
+    }
+    for (const auto &i : defs_) {
+      if (locals.insert(i).second) info_.locals.push_back(i);
+    }
+    // filter out local variables, definitions that read before
+    // being defined are also free variables
+    std::set<SymId> arg_set(args.begin(), args.end());
+    for (const auto &i : refs_) {
+      if (!locals.count(i) || (early_refs_.count(i) && !arg_set.count(i))) {
+        info_.free_vars.push_back(i);
+      }
+    }
+    for (const auto &i : captured_) {
+      if (locals.count(i)) info_.captured.insert(i);
+    }
+  }
+
+ private:
+  void AddRef(SymId id) {
+    if (ref_set_.insert(id).second) refs_.push_back(id);
+  }
+
+  FuncVarInfo &info_;
+  IdList defs_, refs_;
+  std::set<SymId> ref_set_, early_refs_, captured_;
+};
+
+}  // namespace
+
+FuncVarInfo ionia::AnalyzeFuncVars(const IdList &args,
+                                   const ASTPtr &expr) {
+  FuncVarInfo info;
+  VarCollector collector(info);
+  collector.Collect(expr);
+  collector.Finish(args);
+  return info;
+}
@@ -0,0 +1,31 @@
+#ifndef IONIA_BACK_COMPILER_FREEVAR_H_
+#define IONIA_BACK_COMPILER_FREEVAR_H_
+
+#include <set>
+
+#include "define/ast.h"
+
+namespace ionia {
+
+// variable information of a function definition
+struct FuncVarInfo {
+  // all local variables, arguments first and then definitions
+  IdList locals;
+  // identifiers defined by 'DefineAST' in function body
+  std::set<SymId> defines;
+  // identifiers defined more than once in function body,
+  // arguments that defined in function body are also included
+  std::set<SymId> redefines;
+  // local variables that captured by inner functions
+  std::set<SymId> captured;
+  // free variables (including globals) in order of occurrence,
+  // definitions that read before being defined are also included
+  IdList free_vars;
+};
+
+// analyze local and free variables of function
+FuncVarInfo AnalyzeFuncVars(const IdList &args, const ASTPtr &expr);
+
+}  // namespace ionia
+
+#endif  // IONIA_BACK_COMPILER_FREEVAR_H_
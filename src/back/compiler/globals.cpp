@@ -0,0 +1,57 @@
+#include "back/compiler/globals.h"
+
+#include <cstddef>
+
+#include "define/intern.h"
+
+using namespace ionia;
+
+namespace {
+
+// names of all builtin functions of interpreter & VM
+const char *kBuiltinNames[] = {
+  "<<<", ">>>", "?", "is", "eq", "neq", "lt", "le", "gt", "ge",
+  "+", "-", "*", "/", "%", "&", "|", "~", "^", "<<", ">>",
+  "&&", "||", "!",
+};
+
+}  // namespace
+
+void GlobalDefTable::AddStatement(const ASTPtr &ast) {
+  if (auto def = dynamic_cast<const DefineAST *>(ast.get())) {
+    auto &info = defs_[def->id()];
+    ++info.count;
+    info.expr = def->expr().get();
+    AddStatement(def->expr());
+  }
+  else if (auto call = dynamic_cast<const FunCallAST *>(ast.get())) {
+    AddStatement(call->callee());
+    for (const auto &i : call->args()) AddStatement(i);
+  }
+  // definitions in function bodies are always local
+}
+
+void GlobalDefTable::Reset() {
+  defs_.clear();
+  // builtin functions are defined before the program runs,
+  // so any user definition of them is a rebinding
+  for (const auto &i : kBuiltinNames) defs_[InternId(i)] = {1, nullptr};
+}
+
+const BaseAST *GlobalDefTable::GetUniqueDef(SymId id) const {
+  auto it = defs_.find(id);
+  if (it == defs_.end() || it->second.count != 1) return nullptr;
+  return it->second.expr;
+}
+
+const FuncAST *GlobalDefTable::GetKnownFunc(SymId id) const {
+  auto expr = GetUniqueDef(id);
+  // follow aliases like 'top = car', stop if there is a cycle
+  for (std::size_t i = 0; i < defs_.size() && expr; ++i) {
+    if (auto func = dynamic_cast<const FuncAST *>(expr)) return func;
+    auto alias = dynamic_cast<const IdAST *>(expr);
+    if (!alias) break;
+    expr = GetUniqueDef(alias->id());
+  }
+  return nullptr;
+}
@@ -0,0 +1,38 @@
+#ifndef IONIA_BACK_COMPILER_GLOBALS_H_
+#define IONIA_BACK_COMPILER_GLOBALS_H_
+
+#include <map>
+
+#include "define/ast.h"
+
+namespace ionia {
+
+// table of all definitions of global variables in program
+class GlobalDefTable {
+ public:
+  GlobalDefTable() { Reset(); }
+
+  // collect global definitions in statement
+  void AddStatement(const ASTPtr &ast);
+  // reset table
+  void Reset();
+
+  // get expression of global variable if it is defined exactly once,
+  // otherwise returns 'nullptr'
+  const BaseAST *GetUniqueDef(SymId id) const;
+  // get function if global variable is only defined as it,
+  // or defined as an alias of another known function
+  const FuncAST *GetKnownFunc(SymId id) const;
+
+ private:
+  struct DefInfo {
+    int count;
+    const BaseAST *expr;
+  };
+
+  std::map<SymId, DefInfo> defs_;
+};
+
+}  // namespace ionia
+
+#endif  // IONIA_BACK_COMPILER_GLOBALS_H_
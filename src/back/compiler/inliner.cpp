@@ -0,0 +1,124 @@
+#include "back/compiler/inliner.h"
+
+#include <set>
+#include <utility>
+#include <algorithm>
+#include <cassert>
+
+#include "back/compiler/freevar.h"
+#include "define/intern.h"
+
+using namespace ionia;
+
+namespace {
+
+// get node count of AST
+std::size_t GetASTSize(const ASTPtr &ast) {
+  if (auto def = dynamic_cast<const DefineAST *>(ast.get())) {
+    return 1 + GetASTSize(def->expr());
+  }
+  else if (auto func = dynamic_cast<const FuncAST *>(ast.get())) {
+    return 1 + GetASTSize(func->expr());
+  }
+  else if (auto call = dynamic_cast<const FunCallAST *>(ast.get())) {
+    auto size = 1 + GetASTSize(call->callee());
+    for (const auto &i : call->args()) size += GetASTSize(i);
+    return size;
+  }
+  else {
+    return 1;
+  }
+}
+
+}  // namespace
+
+// definitions of static member variables
+const std::size_t Inliner::kDefaultBudget;
+const std::size_t Inliner::kMaxDepth;
+
+const Inliner::FuncInfo &Inliner::GetFuncInfo(SymId id,
+                                              const FuncAST *func) {
+  auto it = infos_.find(id);
+  if (it == infos_.end()) {
+    FuncInfo info;
+    info.size = GetASTSize(func->expr());
+    info.recursive = IsInCycle(func);
+    it = infos_.insert({id, info}).first;
+  }
+  return it->second;
+}
+
+const std::vector<const FuncAST *> &Inliner::GetCallees(
+    const FuncAST *func) {
+  auto it = callees_.find(func);
+  if (it == callees_.end()) {
+    // known functions that referred by free variables
+    std::vector<const FuncAST *> callees;
+    auto vars = AnalyzeFuncVars(func->args(), func->expr());
+    for (const auto &i : vars.free_vars) {
+      if (auto callee = globals_.GetKnownFunc(i)) callees.push_back(callee);
+    }
+    it = callees_.insert({func, std::move(callees)}).first;
+  }
+  return it->second;
+}
+
+bool Inliner::IsInCycle(const FuncAST *func) {
+  // search call graph of known functions from callees of 'func'
+  std::set<const FuncAST *> visited;
+  std::vector<const FuncAST *> funcs = GetCallees(func);
+  while (!funcs.empty()) {
+    auto cur = funcs.back();
+    funcs.pop_back();
+    if (cur == func) return true;
+    if (!visited.insert(cur).second) continue;
+    const auto &callees = GetCallees(cur);
+    funcs.insert(funcs.end(), callees.begin(), callees.end());
+  }
+  return false;
+}
+
+const FuncAST *Inliner::Dump(SymId id, const std::string &caller,
+                             const FuncAST *func, const char *reason) {
+  if (dump_) {
+    *dump_ << "inline: '" << GetIdName(id) << "' in '" << caller << "': ";
+    if (func) {
+      *dump_ << "inlined, size = " << GetFuncInfo(id, func).size;
+    }
+    else {
+      *dump_ << "skipped, " << reason;
+    }
+    *dump_ << std::endl;
+  }
+  return func;
+}
+
+const FuncAST *Inliner::CheckCall(SymId id, std::size_t arg_count,
+                                  const std::string &caller) {
+  // only known functions can be inlined
+  auto func = globals_.GetKnownFunc(id);
+  if (!func) return nullptr;
+  // check argument count
+  if (func->args().size() != arg_count) {
+    return Dump(id, caller, nullptr, "argument count mismatch");
+  }
+  // check function info
+  const auto &info = GetFuncInfo(id, func);
+  if (info.recursive) return Dump(id, caller, nullptr, "recursive");
+  if (info.size > budget_) return Dump(id, caller, nullptr, "too large");
+  // check if is already being inlined
+  if (std::find(inlining_.begin(), inlining_.end(), id) !=
+      inlining_.end()) {
+    return Dump(id, caller, nullptr, "mutually recursive");
+  }
+  if (inlining_.size() >= kMaxDepth) {
+    return Dump(id, caller, nullptr, "too deep");
+  }
+  return Dump(id, caller, func, nullptr);
+}
+
+void Inliner::Reset() {
+  infos_.clear();
+  callees_.clear();
+  inlining_.clear();
+}
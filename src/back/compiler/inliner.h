@@ -0,0 +1,69 @@
+#ifndef IONIA_BACK_COMPILER_INLINER_H_
+#define IONIA_BACK_COMPILER_INLINER_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <cstddef>
+
+#include "define/ast.h"
+#include "back/compiler/globals.h"
+
+namespace ionia {
+
+// make inlining decisions for calls of known global functions
+class Inliner {
+ public:
+  Inliner(const GlobalDefTable &globals)
+      : globals_(globals), budget_(kDefaultBudget), dump_(nullptr) {}
+
+  // check if call of global function can be inlined
+  // returns the function if can, otherwise returns 'nullptr'
+  const FuncAST *CheckCall(SymId id, std::size_t arg_count,
+                           const std::string &caller);
+  // enter/exit the body of inlined function
+  void Enter(SymId id) { inlining_.push_back(id); }
+  void Exit() { inlining_.pop_back(); }
+  // reset inliner
+  void Reset();
+
+  // setters
+  // set maximum size (AST node count) of inlined function body
+  void set_budget(std::size_t budget) { budget_ = budget; }
+  // set stream for dumping inlining decisions, 'nullptr' to disable
+  void set_dump(std::ostream *dump) { dump_ = dump; }
+
+ private:
+  // default value of budget
+  static const std::size_t kDefaultBudget = 16;
+  // maximum depth of nested inlining
+  static const std::size_t kMaxDepth = 4;
+
+  struct FuncInfo {
+    std::size_t size;
+    // set if function is in a cycle of known functions
+    bool recursive;
+  };
+
+  // get information of known function
+  const FuncInfo &GetFuncInfo(SymId id, const FuncAST *func);
+  // get known functions that may be called by function
+  const std::vector<const FuncAST *> &GetCallees(const FuncAST *func);
+  // check if function can reach itself in call graph of known functions
+  bool IsInCycle(const FuncAST *func);
+  // dump inlining decision
+  const FuncAST *Dump(SymId id, const std::string &caller,
+                      const FuncAST *func, const char *reason);
+
+  const GlobalDefTable &globals_;
+  std::size_t budget_;
+  std::ostream *dump_;
+  std::map<SymId, FuncInfo> infos_;
+  std::map<const FuncAST *, std::vector<const FuncAST *>> callees_;
+  std::vector<SymId> inlining_;
+};
+
+}  // namespace ionia
+
+#endif  // IONIA_BACK_COMPILER_INLINER_H_
@@ -0,0 +1,78 @@
+#include "back/compiler/ir.h"
+
+using namespace ionia::ir;
+
+namespace {
+
+constexpr const char *kOpName[] = {
+  IR_OP_ALL(IR_EXPAND_STR_ARRAY)
+};
+
+}  // namespace
+
+UseInfo ionia::ir::AnalyzeUses(const Function &func) {
+  UseInfo info;
+  info.use_count.assign(func.value_count, 0);
+  info.user.assign(func.value_count, 0);
+  info.def.assign(func.value_count, 0);
+  for (std::size_t i = 0; i < func.insts.size(); ++i) {
+    const auto &inst = func.insts[i];
+    info.def[inst.value] = i;
+    for (const auto &v : inst.opers) {
+      ++info.use_count[v];
+      info.user[v] = i;
+    }
+  }
+  return info;
+}
+
+bool ionia::ir::IsPure(const Inst &inst) {
+  switch (inst.op) {
+    case Op::Num: case Op::LoadLocal: case Op::LoadCaptured:
+    case Op::FuncRef: case Op::Closure: {
+      return true;
+    }
+    // loading global or unboxing may fail at runtime
+    default: return false;
+  }
+}
+
+void ionia::ir::DumpFunction(std::ostream &os, const Function &func) {
+  if (func.label.empty()) {
+    os << "main";
+  }
+  else {
+    os << func.label;
+    if (!func.name.empty()) os << " (" << func.name << ")";
+  }
+  os << ":    ; args = " << func.arg_count;
+  os << ", slots = " << func.slot_count << std::endl;
+  for (const auto &inst : func.insts) {
+    os << "  %" << inst.value << " = ";
+    if (inst.tail) os << "tail ";
+    os << kOpName[static_cast<int>(inst.op)];
+    switch (inst.op) {
+      case Op::Num: case Op::LoadLocal: case Op::StoreLocal:
+      case Op::LoadCaptured: case Op::Box: case Op::StoreBox: {
+        os << " " << inst.imm;
+        break;
+      }
+      case Op::LoadGlobal: case Op::StoreGlobal: case Op::FuncRef:
+      case Op::Closure: {
+        os << " " << inst.name;
+        break;
+      }
+      default:;
+    }
+    for (const auto &v : inst.opers) os << " %" << v;
+    os << std::endl;
+  }
+}
+
+void ionia::ir::DumpModule(std::ostream &os, const Module &module) {
+  DumpFunction(os, module.main);
+  for (const auto &func : module.funcs) {
+    os << std::endl;
+    DumpFunction(os, func);
+  }
+}
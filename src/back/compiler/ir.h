@@ -0,0 +1,109 @@
+#ifndef IONIA_BACK_COMPILER_IR_H_
+#define IONIA_BACK_COMPILER_IR_H_
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+// all operations of IR
+#define IR_OP_ALL(f)                                        \
+  f(Num) f(LoadLocal) f(StoreLocal) f(LoadGlobal) f(StoreGlobal) \
+  f(LoadCaptured) f(Box) f(Unbox) f(StoreBox) f(FuncRef)    \
+  f(Closure) f(Call) f(Return)
+// expand macro to comma-separated list
+#define IR_EXPAND_LIST(i)         i,
+// expand macro to comma-separated string array
+#define IR_EXPAND_STR_ARRAY(i)    #i,
+
+namespace ionia::ir {
+
+// A-normal form IR of compiler
+// every instruction defines a value that can be used exactly once
+// by instructions after it (except the ones produced by passes),
+// local variables live in frame slots and are accessed explicitly
+//
+// Num           imm = number
+// LoadLocal     imm = slot
+// StoreLocal    imm = slot, opers = {value}, defines the stored value
+// LoadGlobal    name = symbol
+// StoreGlobal   name = symbol, opers = {value}, defines the stored value
+// LoadCaptured  imm = index of captured value in closure
+// Box           imm = slot, puts value of slot into a new box
+// Unbox         opers = {box}
+// StoreBox      imm = slot of box, opers = {value}, defines the value
+// FuncRef       name = label, reference to closed (known) function
+// Closure       name = label, opers = captured values
+// Call          opers = {callee, args...}
+// Return        opers = {value}, or empty in top level code that is not
+//               compiled incrementally
+enum class Op { IR_OP_ALL(IR_EXPAND_LIST) };
+
+// id of value, index of the defining instruction is not required
+using ValueId = std::uint32_t;
+
+struct Inst {
+  Op op;
+  // value defined by instruction
+  ValueId value;
+  std::vector<ValueId> opers;
+  std::int32_t imm;
+  std::string name;
+  // set if call is in tail position
+  bool tail;
+};
+
+using InstList = std::vector<Inst>;
+
+// function in IR, top level code is also a function
+struct Function {
+  // label of function, empty if is top level code
+  std::string label;
+  // name of global function, or empty if function is anonymous
+  std::string name;
+  std::uint32_t arg_count;
+  // number of slots of arguments and local variables
+  std::uint32_t slot_count;
+  InstList insts;
+  // number of allocated value ids
+  ValueId value_count;
+
+  // append a new instruction, returns the value it defines
+  ValueId Add(Op op, std::vector<ValueId> opers = {},
+              std::int32_t imm = 0, const std::string &name = "") {
+    auto value = value_count++;
+    insts.push_back({op, value, std::move(opers), imm, name, false});
+    return value;
+  }
+};
+
+// all functions of program
+struct Module {
+  Function main;
+  std::vector<Function> funcs;
+};
+
+// use information of values in function
+struct UseInfo {
+  // number of uses of each value
+  std::vector<std::uint32_t> use_count;
+  // index of the last instruction that uses each value
+  std::vector<std::size_t> user;
+  // index of instruction that defines each value
+  std::vector<std::size_t> def;
+};
+
+// analyze uses of all values in function
+UseInfo AnalyzeUses(const Function &func);
+
+// check if instruction has no side effects
+bool IsPure(const Inst &inst);
+
+// dump IR to stream
+void DumpFunction(std::ostream &os, const Function &func);
+void DumpModule(std::ostream &os, const Module &module);
+
+}  // namespace ionia::ir
+
+#endif  // IONIA_BACK_COMPILER_IR_H_
@@ -0,0 +1,469 @@
+#include "back/compiler/lowering.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace ionia::ir;
+
+bool Lowering::LowerModule(const Module &module) {
+  is_reg_mode_ = gen_.mode() == vm::CodeMode::Register;
+  is_overflow_ = false;
+  auto func_count = gen_.pc_table().size() + module.funcs.size();
+  is_short_func_id_ = func_count <= UINT16_MAX + 1;
+  arg_counts_.clear();
+  for (const auto &func : module.funcs) {
+    arg_counts_[func.label] = func.arg_count;
+  }
+  LowerFunction(module.main);
+  for (const auto &func : module.funcs) LowerFunction(func);
+  return !is_overflow_;
+}
+
+void Lowering::LowerFunction(const Function &func) {
+  func_ = &func;
+  auto spill_count = Schedule();
+  if (!func.label.empty()) gen_.LABEL(func.label);
+  // spill slots are placed after local variables,
+  // temporary registers are placed after spill slots
+  used_regs_ = reg_count_ = func.slot_count + spill_count;
+  if (reg_count_ > vm::kMaxRegCount) is_overflow_ = true;
+  for (std::size_t i = 0; i < func.insts.size(); ++i) {
+    const auto &inst = func.insts[i];
+    // values that are used once are generated by their users or spilled
+    if (uses_.use_count[inst.value] == 1) continue;
+    for (const auto &v : flushes_[i]) {
+      if (is_reg_mode_) {
+        LowerRegInst(GetInst(v), spills_[v], false);
+      }
+      else {
+        LowerStackInst(GetInst(v));
+        gen_.SETL(spills_[v]);
+      }
+    }
+    if (is_reg_mode_) {
+      LowerRegRoot(inst);
+    }
+    else {
+      LowerStackRoot(inst);
+    }
+  }
+  // register function info
+  auto slot_count = is_reg_mode_ ? reg_count_ : used_regs_;
+  if (func.label.empty()) {
+    gen_.set_main_slot_count(slot_count);
+  }
+  else {
+    gen_.RegisterFunctionInfo(func.label, func.arg_count, slot_count);
+    // check if is global function
+    if (func.name[0] == '$') {
+      gen_.RegisterGlobalFunction(func.name, func.label, func.arg_count);
+    }
+  }
+}
+
+std::uint32_t Lowering::Schedule() {
+  uses_ = AnalyzeUses(*func_);
+  spills_.assign(func_->value_count, kNoSlot);
+  flushes_.assign(func_->insts.size(), {});
+  AnalyzeMovable();
+  std::uint32_t count = 0;
+  // values that have not been generated by their users yet
+  std::vector<ValueId> pending;
+  // range of unmovable instructions in expression tree of each pending
+  // value, indices are counted from 1, and 0 means empty
+  std::vector<std::pair<std::size_t, std::size_t>> ranges(
+      func_->value_count);
+  // values that must be spilled before the next root
+  std::vector<ValueId> early;
+  for (std::size_t i = 0; i < func_->insts.size(); ++i) {
+    const auto &inst = func_->insts[i];
+    // pending values will be generated in the same order as IR
+    // only if the range of current expression tree is after
+    // ranges of other pending values
+    auto range = GetRange(inst, pending, ranges);
+    auto is_in_order = range.first != 0 || range.second == 0;
+    for (const auto &v : pending) {
+      if (std::find(inst.opers.begin(), inst.opers.end(), v) !=
+              inst.opers.end()) {
+        continue;
+      }
+      if (ranges[v].first && range.second &&
+          ranges[v].second >= range.first) {
+        is_in_order = false;
+      }
+    }
+    if (!is_in_order) {
+      // spill all unmovable pending values, they are spilled
+      // in the same order as IR
+      for (const auto &v : pending) {
+        if (!ranges[v].first) continue;
+        spills_[v] = func_->slot_count + count++;
+        early.push_back(v);
+      }
+      pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                   [&ranges](ValueId v) {
+                                     return ranges[v].first != 0;
+                                   }),
+                    pending.end());
+      range = GetRange(inst, pending, ranges);
+    }
+    if (uses_.use_count[inst.value] == 1) {
+      // operands will be generated by current instruction
+      for (const auto &v : inst.opers) {
+        auto it = std::find(pending.begin(), pending.end(), v);
+        if (it != pending.end()) pending.erase(it);
+      }
+      pending.push_back(inst.value);
+      ranges[inst.value] = range;
+    }
+    else {
+      // pending values not used by current instruction must be spilled,
+      // otherwise they will be evaluated after its side effects
+      flushes_[i] = std::move(early);
+      early.clear();
+      for (const auto &v : pending) {
+        if (uses_.user[v] != i) {
+          spills_[v] = func_->slot_count + count++;
+          flushes_[i].push_back(v);
+        }
+      }
+      pending.clear();
+      if (uses_.use_count[inst.value]) {
+        spills_[inst.value] = func_->slot_count + count++;
+      }
+    }
+  }
+  return count;
+}
+
+void Lowering::AnalyzeMovable() {
+  // index after the last instruction that writes each slot
+  std::vector<std::size_t> last_write(func_->slot_count, 0);
+  for (std::size_t i = 0; i < func_->insts.size(); ++i) {
+    const auto &inst = func_->insts[i];
+    if (inst.op == Op::StoreLocal || inst.op == Op::Box) {
+      last_write[inst.imm] = i + 1;
+    }
+  }
+  movable_.assign(func_->value_count, false);
+  for (std::size_t i = 0; i < func_->insts.size(); ++i) {
+    const auto &inst = func_->insts[i];
+    switch (inst.op) {
+      // captured values are never changed
+      case Op::Num: case Op::FuncRef: case Op::LoadCaptured:
+      case Op::Closure: {
+        movable_[inst.value] = true;
+        break;
+      }
+      // slot is not changed after being read
+      case Op::LoadLocal: {
+        movable_[inst.value] = last_write[inst.imm] <= i;
+        break;
+      }
+      // others may have side effects, or be affected by side effects
+      default: break;
+    }
+  }
+}
+
+std::pair<std::size_t, std::size_t> Lowering::GetRange(
+    const Inst &inst, const std::vector<ValueId> &pending,
+    const std::vector<std::pair<std::size_t, std::size_t>> &ranges) const {
+  // operands in order of generation, callee is generated after arguments
+  auto opers = inst.opers;
+  if (inst.op == Op::Call) {
+    std::rotate(opers.begin(), opers.begin() + 1, opers.end());
+  }
+  // the first element will be 0 if ranges of operands overlap
+  std::size_t first = 0, last = 0;
+  bool is_overlap = false;
+  for (const auto &v : opers) {
+    if (std::find(pending.begin(), pending.end(), v) == pending.end()) {
+      continue;
+    }
+    if (!ranges[v].first) continue;
+    if (ranges[v].first <= last) is_overlap = true;
+    if (!first) first = ranges[v].first;
+    last = ranges[v].second;
+  }
+  auto index = uses_.def[inst.value] + 1;
+  if (!movable_[inst.value]) {
+    if (!first) first = index;
+    last = index;
+  }
+  return {is_overlap ? 0 : first, last};
+}
+
+bool Lowering::GetSlot(ValueId value, std::uint32_t &slot) const {
+  if (spills_[value] != kNoSlot) {
+    slot = spills_[value];
+    return true;
+  }
+  const auto &inst = GetInst(value);
+  if (inst.op != Op::LoadLocal) return false;
+  slot = inst.imm;
+  return true;
+}
+
+const std::string *Lowering::GetDirectCallee(const Inst &call) const {
+  auto callee = call.opers.front();
+  if (spills_[callee] != kNoSlot) return nullptr;
+  const auto &inst = GetInst(callee);
+  if (inst.op != Op::FuncRef) return nullptr;
+  // argument count must match, otherwise report error at runtime
+  auto it = arg_counts_.find(inst.name);
+  if (it == arg_counts_.end()) return nullptr;
+  if (it->second != call.opers.size() - 1) return nullptr;
+  // function id of 'DINV'/'DTIV' is a 16-bit operand
+  if (is_reg_mode_ && !is_short_func_id_) return nullptr;
+  return &inst.name;
+}
+
+void Lowering::LowerStackRoot(const Inst &inst) {
+  if (inst.op == Op::Return) {
+    if (!inst.opers.empty()) {
+      auto value = inst.opers.front();
+      LowerStack(value);
+      // tail call returns by itself
+      if (GetInst(value).tail && spills_[value] == kNoSlot) return;
+    }
+    gen_.RET();
+  }
+  else {
+    LowerStackInst(inst);
+    if (spills_[inst.value] != kNoSlot) gen_.SETL(spills_[inst.value]);
+  }
+}
+
+void Lowering::LowerStack(ValueId value) {
+  if (spills_[value] != kNoSlot) {
+    gen_.GETL(spills_[value]);
+  }
+  else {
+    LowerStackInst(GetInst(value));
+  }
+}
+
+void Lowering::LowerStackInst(const Inst &inst) {
+  switch (inst.op) {
+    case Op::Num: gen_.SetConst(inst.imm); break;
+    case Op::LoadLocal: gen_.GETL(inst.imm); break;
+    case Op::StoreLocal: {
+      LowerStack(inst.opers.front());
+      gen_.SETL(inst.imm);
+      break;
+    }
+    case Op::LoadGlobal: gen_.GET(inst.name); break;
+    case Op::StoreGlobal: {
+      LowerStack(inst.opers.front());
+      gen_.SET(inst.name);
+      break;
+    }
+    case Op::LoadCaptured: gen_.GETC(inst.imm); break;
+    case Op::Box: gen_.BOX(inst.imm); break;
+    case Op::Unbox: {
+      LowerStack(inst.opers.front());
+      gen_.UNBX();
+      break;
+    }
+    case Op::StoreBox: {
+      LowerStack(inst.opers.front());
+      gen_.SETB(inst.imm);
+      break;
+    }
+    case Op::FuncRef: gen_.GetFuncValue(inst.name, 0); break;
+    case Op::Closure: {
+      // push all captured values
+      for (const auto &v : inst.opers) {
+        LowerStack(v);
+        gen_.PUSH();
+      }
+      gen_.GetFuncValue(inst.name, inst.opers.size());
+      break;
+    }
+    case Op::Call: {
+      // push all arguments in order
+      for (std::size_t i = 1; i < inst.opers.size(); ++i) {
+        LowerStack(inst.opers[i]);
+        gen_.PUSH();
+      }
+      // call known function directly
+      if (auto label = GetDirectCallee(inst)) {
+        if (inst.tail) {
+          gen_.DTCL(*label);
+        }
+        else {
+          gen_.DCAL(*label);
+        }
+        break;
+      }
+      // get callee and call it
+      LowerStack(inst.opers.front());
+      if (inst.tail) {
+        gen_.TCAL(inst.opers.size() - 1);
+      }
+      else {
+        gen_.CALL(inst.opers.size() - 1);
+      }
+      break;
+    }
+    default: assert(false);
+  }
+}
+
+std::uint32_t Lowering::AllocReg() {
+  auto reg = used_regs_++;
+  if (used_regs_ > reg_count_) reg_count_ = used_regs_;
+  // registers are encoded as 8-bit operands
+  if (reg_count_ > vm::kMaxRegCount) is_overflow_ = true;
+  return reg;
+}
+
+void Lowering::FreeRegs(std::uint32_t base) {
+  assert(base <= used_regs_);
+  used_regs_ = base;
+}
+
+void Lowering::LowerRegRoot(const Inst &inst) {
+  if (inst.op == Op::Return) {
+    std::uint32_t slot;
+    if (inst.opers.empty()) {
+      // return value of top level code is never used
+      auto dest = AllocReg();
+      gen_.RTN(dest);
+      FreeRegs(dest);
+    }
+    else if (GetSlot(inst.opers.front(), slot)) {
+      gen_.RTN(slot);
+    }
+    else {
+      auto value = inst.opers.front();
+      auto dest = AllocReg();
+      LowerReg(value, dest, true);
+      // tail call returns by itself
+      if (!GetInst(value).tail) gen_.RTN(dest);
+      FreeRegs(dest);
+    }
+  }
+  else if (spills_[inst.value] != kNoSlot) {
+    LowerRegInst(inst, spills_[inst.value], false);
+  }
+  else if (inst.op == Op::StoreLocal) {
+    // store to local variable directly
+    LowerReg(inst.opers.front(), inst.imm, false);
+  }
+  else {
+    auto dest = AllocReg();
+    LowerRegInst(inst, dest, true);
+    FreeRegs(dest);
+  }
+}
+
+void Lowering::LowerReg(ValueId value, std::uint32_t dest, bool is_temp) {
+  if (spills_[value] != kNoSlot) {
+    if (spills_[value] != dest) gen_.MOV(dest, spills_[value]);
+  }
+  else {
+    LowerRegInst(GetInst(value), dest, is_temp);
+  }
+}
+
+void Lowering::LowerRegInst(const Inst &inst, std::uint32_t dest,
+                            bool is_temp) {
+  switch (inst.op) {
+    case Op::Num: gen_.SetRegConst(dest, inst.imm); break;
+    case Op::LoadLocal: {
+      if (static_cast<std::uint32_t>(inst.imm) != dest) {
+        gen_.MOV(dest, inst.imm);
+      }
+      break;
+    }
+    case Op::StoreLocal: {
+      LowerReg(inst.opers.front(), dest, is_temp);
+      if (static_cast<std::uint32_t>(inst.imm) != dest) {
+        gen_.MOV(inst.imm, dest);
+      }
+      break;
+    }
+    case Op::LoadGlobal: gen_.LDG(dest, inst.name); break;
+    case Op::StoreGlobal: {
+      LowerReg(inst.opers.front(), dest, is_temp);
+      gen_.STG(dest, inst.name);
+      break;
+    }
+    case Op::LoadCaptured: {
+      // index of captured value is a 16-bit operand
+      if (inst.imm > UINT16_MAX) is_overflow_ = true;
+      gen_.LDC(dest, inst.imm);
+      break;
+    }
+    case Op::Box: gen_.MKB(inst.imm); break;
+    case Op::Unbox: {
+      // read box in frame slot directly
+      std::uint32_t slot;
+      if (GetSlot(inst.opers.front(), slot)) {
+        gen_.LDB(dest, slot);
+      }
+      else {
+        LowerReg(inst.opers.front(), dest, is_temp);
+        gen_.LDB(dest, dest);
+      }
+      break;
+    }
+    case Op::StoreBox: {
+      LowerReg(inst.opers.front(), dest, is_temp);
+      gen_.STB(inst.imm, dest);
+      break;
+    }
+    case Op::FuncRef: gen_.CLOS(dest, 0, 0, inst.name); break;
+    case Op::Closure: {
+      // put captured values to consecutive registers
+      std::uint32_t base = used_regs_;
+      for (const auto &v : inst.opers) LowerReg(v, AllocReg(), true);
+      if (inst.opers.size() > UINT8_MAX) is_overflow_ = true;
+      gen_.CLOS(dest, base, inst.opers.size(), inst.name);
+      FreeRegs(base);
+      break;
+    }
+    case Op::Call: LowerRegCall(inst, dest, is_temp); break;
+    default: assert(false);
+  }
+}
+
+void Lowering::LowerRegCall(const Inst &inst, std::uint32_t dest,
+                            bool is_temp) {
+  // arguments are placed from 'base', and result of call will be
+  // stored in 'base', so reuse destination if it's a temporary register
+  auto base = is_temp ? dest : AllocReg();
+  auto arg_count = inst.opers.size() - 1;
+  if (arg_count > UINT8_MAX) is_overflow_ = true;
+  // each argument register is the last allocated one when generating
+  for (std::size_t i = 1; i < inst.opers.size(); ++i) {
+    LowerReg(inst.opers[i], i > 1 ? AllocReg() : base, true);
+  }
+  if (auto label = GetDirectCallee(inst)) {
+    // call known function directly
+    if (inst.tail) {
+      gen_.DTIV(base, *label);
+    }
+    else {
+      gen_.DINV(base, *label);
+    }
+  }
+  else {
+    // call local variable directly, otherwise get callee to a new register
+    std::uint32_t func;
+    if (!GetSlot(inst.opers.front(), func)) {
+      func = AllocReg();
+      LowerReg(inst.opers.front(), func, true);
+    }
+    if (inst.tail) {
+      gen_.TINV(func, base, arg_count);
+    }
+    else {
+      gen_.INV(func, base, arg_count);
+    }
+  }
+  FreeRegs(is_temp ? base + 1 : base);
+  if (base != dest) gen_.MOV(dest, base);
+}
@@ -0,0 +1,90 @@
+#ifndef IONIA_BACK_COMPILER_LOWERING_H_
+#define IONIA_BACK_COMPILER_LOWERING_H_
+
+#include <vector>
+#include <string>
+#include <map>
+#include <utility>
+#include <cstdint>
+
+#include "back/compiler/ir.h"
+#include "vm/codegen.h"
+
+namespace ionia::ir {
+
+// lower IR module to instructions of code generator
+//
+// values that are used exactly once are not materialized, they are
+// generated at where they are used, so the expression trees in IR are
+// rebuilt, other values are stored in extra frame slots (spilled)
+class Lowering {
+ public:
+  Lowering(vm::CodeGen &gen) : gen_(gen) {}
+
+  // lower all functions in module, returns false if operands of
+  // register-based instructions can not hold the generated code
+  bool LowerModule(const Module &module);
+
+ private:
+  // no spill slot
+  static constexpr std::uint32_t kNoSlot = UINT32_MAX;
+
+  // lower function
+  void LowerFunction(const Function &func);
+  // decide where to generate each value, returns number of spill slots
+  std::uint32_t Schedule();
+  // find values that can be generated anywhere after their definitions
+  // without changing the order of side effects
+  void AnalyzeMovable();
+  // get range of unmovable instructions in expression tree of instruction
+  std::pair<std::size_t, std::size_t> GetRange(
+      const Inst &inst, const std::vector<ValueId> &pending,
+      const std::vector<std::pair<std::size_t, std::size_t>> &ranges) const;
+  // get instruction that defines value
+  const Inst &GetInst(ValueId value) const {
+    return func_->insts[uses_.def[value]];
+  }
+  // check if value can be read from a frame slot directly
+  bool GetSlot(ValueId value, std::uint32_t &slot) const;
+  // check if call can be performed directly,
+  // returns label of callee if can, otherwise returns 'nullptr'
+  const std::string *GetDirectCallee(const Inst &call) const;
+
+  // stack mode, result will be stored in accumulator
+  void LowerStackRoot(const Inst &inst);
+  void LowerStack(ValueId value);
+  void LowerStackInst(const Inst &inst);
+
+  // register mode, result will be stored in 'dest'
+  // 'is_temp' means 'dest' is the last allocated temporary register
+  std::uint32_t AllocReg();
+  void FreeRegs(std::uint32_t base);
+  void LowerRegRoot(const Inst &inst);
+  void LowerReg(ValueId value, std::uint32_t dest, bool is_temp);
+  void LowerRegInst(const Inst &inst, std::uint32_t dest, bool is_temp);
+  void LowerRegCall(const Inst &inst, std::uint32_t dest, bool is_temp);
+
+  vm::CodeGen &gen_;
+  bool is_reg_mode_;
+  // set if any operand of register-based instructions overflowed
+  bool is_overflow_;
+  // set if ids of all functions fit in operands of 'DINV'/'DTIV'
+  bool is_short_func_id_;
+  // argument count of all functions
+  std::map<std::string, std::uint32_t> arg_counts_;
+  // current function and its use information
+  const Function *func_;
+  UseInfo uses_;
+  // spill slot of each value
+  std::vector<std::uint32_t> spills_;
+  // set if value can be moved, see 'AnalyzeMovable'
+  std::vector<bool> movable_;
+  // values to be spilled before each instruction
+  std::vector<std::vector<ValueId>> flushes_;
+  // used and total registers (frame slots) in register mode
+  std::uint32_t used_regs_, reg_count_;
+};
+
+}  // namespace ionia::ir
+
+#endif  // IONIA_BACK_COMPILER_LOWERING_H_
@@ -0,0 +1,42 @@
+#include "back/compiler/passes.h"
+
+#include <iterator>
+#include <utility>
+#include <cstddef>
+
+using namespace ionia::ir;
+
+bool DeadCodePass::RunOnFunction(Function &func) {
+  auto uses = AnalyzeUses(func);
+  // sweep backward, so operands of removed instructions
+  // can be removed in the same sweep
+  InstList insts;
+  bool changed = false;
+  for (auto it = func.insts.rbegin(); it != func.insts.rend(); ++it) {
+    if (IsPure(*it) && !uses.use_count[it->value]) {
+      for (const auto &v : it->opers) --uses.use_count[v];
+      changed = true;
+    }
+    else {
+      insts.push_back(std::move(*it));
+    }
+  }
+  func.insts.assign(std::make_move_iterator(insts.rbegin()),
+                    std::make_move_iterator(insts.rend()));
+  return changed;
+}
+
+bool TailCallPass::RunOnFunction(Function &func) {
+  // top level code can not perform tail calls
+  if (func.label.empty() || func.insts.size() < 2) return false;
+  const auto &ret = func.insts.back();
+  if (ret.op != Op::Return || ret.opers.size() != 1) return false;
+  // returned value must be defined right before the return,
+  // and must not be used by others
+  auto &call = func.insts[func.insts.size() - 2];
+  if (call.op != Op::Call || call.value != ret.opers.front()) return false;
+  if (AnalyzeUses(func).use_count[call.value] != 1) return false;
+  if (call.tail) return false;
+  call.tail = true;
+  return true;
+}
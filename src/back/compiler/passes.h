@@ -0,0 +1,24 @@
+#ifndef IONIA_BACK_COMPILER_PASSES_H_
+#define IONIA_BACK_COMPILER_PASSES_H_
+
+#include "back/compiler/passman.h"
+
+namespace ionia::ir {
+
+// remove pure instructions whose values are never used
+class DeadCodePass : public PassBase {
+ public:
+  bool RunOnFunction(Function &func) override;
+  const char *name() const override { return "dead-code"; }
+};
+
+// mark calls whose results are returned directly as tail calls
+class TailCallPass : public PassBase {
+ public:
+  bool RunOnFunction(Function &func) override;
+  const char *name() const override { return "tail-call"; }
+};
+
+}  // namespace ionia::ir
+
+#endif  // IONIA_BACK_COMPILER_PASSES_H_
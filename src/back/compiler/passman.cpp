@@ -0,0 +1,17 @@
+#include "back/compiler/passman.h"
+
+using namespace ionia::ir;
+
+void PassManager::Run(Module &module) {
+  auto run = [this](Function &func) {
+    for (const auto &pass : passes_) {
+      if (pass->RunOnFunction(func) && dump_) {
+        *dump_ << "; after " << pass->name() << std::endl;
+        DumpFunction(*dump_, func);
+        *dump_ << std::endl;
+      }
+    }
+  };
+  run(module.main);
+  for (auto &func : module.funcs) run(func);
+}
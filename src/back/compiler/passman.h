@@ -0,0 +1,52 @@
+#ifndef IONIA_BACK_COMPILER_PASSMAN_H_
+#define IONIA_BACK_COMPILER_PASSMAN_H_
+
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <utility>
+
+#include "back/compiler/ir.h"
+
+namespace ionia::ir {
+
+// base class of all passes that run on IR functions
+class PassBase {
+ public:
+  virtual ~PassBase() = default;
+
+  // run pass on function, returns true if function has been changed
+  // analysis passes should never change the function
+  virtual bool RunOnFunction(Function &func) = 0;
+
+  // name of pass, used when dumping
+  virtual const char *name() const = 0;
+};
+
+using PassPtr = std::unique_ptr<PassBase>;
+
+// manage and run passes on IR module
+class PassManager {
+ public:
+  PassManager() : dump_(nullptr) {}
+
+  // register a new pass, passes will be run in order of registration
+  template <typename T, typename... Args>
+  void RegisterPass(Args &&... args) {
+    passes_.push_back(std::make_unique<T>(std::forward<Args>(args)...));
+  }
+  // run all passes on all functions in module
+  void Run(Module &module);
+
+  // setters
+  // set stream for dumping changes made by passes, 'nullptr' to disable
+  void set_dump(std::ostream *dump) { dump_ = dump; }
+
+ private:
+  std::vector<PassPtr> passes_;
+  std::ostream *dump_;
+};
+
+}  // namespace ionia::ir
+
+#endif  // IONIA_BACK_COMPILER_PASSMAN_H_
@@ -0,0 +1,37 @@
+#include "back/compiler/uncurry.h"
+
+#include <algorithm>
+
+using namespace ionia;
+
+bool ionia::AnalyzeCurriedFunc(const FuncAST &func, CurriedFunc &info) {
+  info.arities.clear();
+  info.args.clear();
+  // walk through all nested functions
+  auto cur = &func;
+  for (;;) {
+    info.arities.push_back(cur->args().size());
+    info.args.insert(info.args.end(), cur->args().begin(),
+                     cur->args().end());
+    auto inner = dynamic_cast<const FuncAST *>(cur->expr().get());
+    if (!inner) break;
+    cur = inner;
+  }
+  info.body = &cur->expr();
+  return info.arities.size() > 1;
+}
+
+const ASTPtr &ionia::FlattenCallChain(
+    const ASTPtr &callee, const ASTPtrList &args,
+    std::vector<const ASTPtrList *> &arg_lists) {
+  arg_lists.clear();
+  arg_lists.push_back(&args);
+  auto cur = &callee;
+  while (auto call = dynamic_cast<const FunCallAST *>(cur->get())) {
+    arg_lists.push_back(&call->args());
+    cur = &call->callee();
+  }
+  // make the innermost call first
+  std::reverse(arg_lists.begin(), arg_lists.end());
+  return *cur;
+}
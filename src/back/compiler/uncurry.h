@@ -0,0 +1,31 @@
+#ifndef IONIA_BACK_COMPILER_UNCURRY_H_
+#define IONIA_BACK_COMPILER_UNCURRY_H_
+
+#include <vector>
+#include <cstddef>
+
+#include "define/ast.h"
+
+namespace ionia {
+
+// information of curried function like '(x): (y): (z): ...'
+struct CurriedFunc {
+  // argument count of each level
+  std::vector<std::size_t> arities;
+  // arguments of all levels
+  IdList args;
+  // body of the innermost function
+  const ASTPtr *body;
+};
+
+// analyze curried function, returns false if function is not curried
+bool AnalyzeCurriedFunc(const FuncAST &func, CurriedFunc &info);
+
+// flatten call chain like 'f(a)(b)(c)',
+// returns the innermost callee and argument lists of each call
+const ASTPtr &FlattenCallChain(const ASTPtr &callee, const ASTPtrList &args,
+                               std::vector<const ASTPtrList *> &arg_lists);
+
+}  // namespace ionia
+
+#endif  // IONIA_BACK_COMPILER_UNCURRY_H_
@@ -0,0 +1,202 @@
+#include "back/interpreter/closure.h"
+
+#include <array>
+#include <memory>
+
+#include "define/intern.h"
+
+using namespace ionia;
+
+namespace {
+
+// symbol of builtin 'if' function
+const SymId kIf = InternId("?");
+
+// make code that evaluates 'N' arguments and calls function
+template <std::size_t N, typename Call>
+Code MakeCall(const CodeList &args, Call call) {
+  std::array<Code, N> codes;
+  for (std::size_t i = 0; i < N; ++i) codes[i] = args[i];
+  return [codes, call]() {
+    std::array<Value, N> vals;
+    for (std::size_t i = 0; i < N; ++i) {
+      if (!(vals[i] = codes[i]())) return Value();
+    }
+    return call(vals.data());
+  };
+}
+
+}  // namespace
+
+Value ClosureCompiler::CallValue(Interpreter &intp, const Value &callee,
+                                 const Value *args, std::size_t arg_count,
+                                 bool is_tail) {
+  if (!callee || !callee.is_func()) {
+    return intp.PrintError("invalid function");
+  }
+  if (is_tail) return intp.TailCall(callee, args, arg_count);
+  return intp.CallFunc(callee, args, arg_count);
+}
+
+Code ClosureCompiler::Compile(const ASTPtr &ast) {
+  if (auto id = dynamic_cast<const IdAST *>(ast.get())) {
+    return CompileId(*id);
+  }
+  else if (auto num = dynamic_cast<const NumAST *>(ast.get())) {
+    return [value = Value(num->num())]() { return value; };
+  }
+  else if (auto def = dynamic_cast<const DefineAST *>(ast.get())) {
+    return CompileDefine(*def);
+  }
+  else if (auto func = dynamic_cast<const FuncAST *>(ast.get())) {
+    return CompileFunc(*func);
+  }
+  else {
+    auto call = dynamic_cast<const FunCallAST *>(ast.get());
+    return CompileFunCall(*call);
+  }
+}
+
+Code ClosureCompiler::CompileId(const IdAST &ast) {
+  auto intp = &intp_;
+  auto id = ast.id();
+  const auto &slots = ast.slots();
+  if (slots.empty()) {
+    // global variable
+    return [intp, id]() {
+      auto value = intp->global_->GetValue(id);
+      if (!value) return intp->PrintError("identifier not found");
+      return value;
+    };
+  }
+  else if (slots.size() == 1 && !slots.front().depth) {
+    // local variable of current function
+    auto index = slots.front().index;
+    return [intp, id, index]() {
+      const auto &value = intp->envs_.top()->GetSlot(index);
+      if (value) return value;
+      return intp->EvalId(id, {});
+    };
+  }
+  else {
+    return [intp, id, slots]() { return intp->EvalId(id, slots); };
+  }
+}
+
+Code ClosureCompiler::CompileDefine(const DefineAST &ast) {
+  auto intp = &intp_;
+  auto id = ast.id();
+  auto slot = ast.slot();
+  auto expr = Compile(ast.expr());
+  if (slot == kGlobalSlot) {
+    return [intp, id, expr]() {
+      auto value = expr();
+      if (value) intp->envs_.top()->AddSymbol(id, value);
+      return value;
+    };
+  }
+  else {
+    return [intp, slot, expr]() {
+      auto value = expr();
+      if (value) intp->envs_.top()->SetSlot(slot, value);
+      return value;
+    };
+  }
+}
+
+Code ClosureCompiler::CompileFunc(const FuncAST &ast) {
+  // body is compiled only once
+  ASTPtr func = std::make_shared<CompiledFuncAST>(ast, Compile(ast.expr()));
+  auto intp = &intp_;
+  return [intp, func]() { return Value(intp->envs_.top(), func); };
+}
+
+Code ClosureCompiler::CompileFunCall(const FunCallAST &ast) {
+  CodeList args;
+  for (const auto &i : ast.args()) args.push_back(Compile(i));
+  if (auto code = CompileBuiltinCall(ast, args)) return code;
+  // arguments are evaluated before callee
+  auto intp = &intp_;
+  auto callee = Compile(ast.callee());
+  auto is_tail = ast.is_tail();
+  auto call = [intp, callee, is_tail](std::size_t arg_count) {
+    return [intp, callee, arg_count, is_tail](const Value *vals) {
+      return CallValue(*intp, callee(), vals, arg_count, is_tail);
+    };
+  };
+  switch (args.size()) {
+    case 0: return MakeCall<0>(args, call(0));
+    case 1: return MakeCall<1>(args, call(1));
+    case 2: return MakeCall<2>(args, call(2));
+    case 3: return MakeCall<3>(args, call(3));
+    default: {
+      return [intp, callee, args, is_tail]() {
+        ValueList vals;
+        for (const auto &i : args) {
+          vals.push_back(i());
+          if (!vals.back()) return Value();
+        }
+        return CallValue(*intp, callee(), vals.data(), vals.size(),
+                         is_tail);
+      };
+    }
+  }
+}
+
+Code ClosureCompiler::CompileBuiltinCall(const FunCallAST &ast,
+                                         const CodeList &args) {
+  // callee must be a global variable
+  auto id = dynamic_cast<const IdAST *>(ast.callee().get());
+  if (!id || !id->slots().empty()) return nullptr;
+  auto sym = id->id();
+  auto builtin = intp_.root_->GetValue(sym);
+  if (!builtin) return nullptr;
+  // get callee, and check if it is still the builtin function
+  auto intp = &intp_;
+  auto is_tail = ast.is_tail();
+  auto get_callee = [intp, sym, builtin](Value &callee) {
+    callee = intp->global_->GetValue(sym);
+    return callee.Is(builtin);
+  };
+  if (sym == kIf && args.size() == 3) {
+    return MakeCall<3>(args, [intp, get_callee, is_tail](const Value *vals) {
+      Value callee;
+      if (!get_callee(callee)) {
+        return CallValue(*intp, callee, vals, 3, is_tail);
+      }
+      // same as 'Interpreter::IonIf'
+      if (vals[0].is_func() || !vals[1].is_func() || !vals[2].is_func()) {
+        return intp->PrintError("invalid argument");
+      }
+      const auto &branch = vals[0].num_val() ? vals[1] : vals[2];
+      if (is_tail) return intp->TailCall(branch, nullptr, 0);
+      return intp->CallFunc(branch, nullptr, 0);
+    });
+  }
+  auto it = intp_.builtin_ops_.find(sym);
+  if (it == intp_.builtin_ops_.end()) return nullptr;
+  auto op = it->second;
+  auto is_unary = op == Interpreter::Operator::Not ||
+                  op == Interpreter::Operator::LogicNot;
+  if (args.size() != (is_unary ? 1 : 2)) return nullptr;
+  if (is_unary) {
+    return MakeCall<1>(args, [intp, get_callee, op, is_tail](
+                                 const Value *vals) {
+      Value callee;
+      if (!get_callee(callee)) {
+        return CallValue(*intp, callee, vals, 1, is_tail);
+      }
+      return intp->CalcOp(op, vals[0], Value());
+    });
+  }
+  else {
+    return MakeCall<2>(args, [intp, get_callee, op, is_tail](
+                                 const Value *vals) {
+      Value callee;
+      if (!get_callee(callee)) {
+        return CallValue(*intp, callee, vals, 2, is_tail);
+      }
+      return intp->CalcOp(op, vals[0], vals[1]);
+    });
+  }
+}
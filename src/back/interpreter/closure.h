@@ -0,0 +1,63 @@
+#ifndef IONIA_BACK_INTERPRETER_CLOSURE_H_
+#define IONIA_BACK_INTERPRETER_CLOSURE_H_
+
+#include <functional>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+#include "define/ast.h"
+#include "define/symbol.h"
+#include "back/interpreter/interpreter.h"
+
+namespace ionia {
+
+// compiled code of expression, returns null value if error occurred
+using Code = std::function<Value()>;
+using CodeList = std::vector<Code>;
+
+// function whose body has been compiled to code
+class CompiledFuncAST : public FuncAST {
+ public:
+  CompiledFuncAST(const FuncAST &func, Code body)
+      : FuncAST(func.args(), func.expr(), func.slot_count(),
+                func.arg_slots()),
+        body_(std::move(body)) {}
+
+  Value Call(Interpreter &intp) const override { return body_(); }
+
+ private:
+  Code body_;
+};
+
+// closure compiler, converts resolved AST to a tree of callables
+// so that kind of node is only checked once, all function bodies in
+// AST are compiled once, and calls of builtin operators are bound
+// to their implementations, which are guarded by checking if
+// the builtin function has been redefined
+class ClosureCompiler {
+ public:
+  ClosureCompiler(Interpreter &intp) : intp_(intp) {}
+
+  // compile resolved AST
+  Code Compile(const ASTPtr &ast);
+
+ private:
+  Code CompileId(const IdAST &ast);
+  Code CompileDefine(const DefineAST &ast);
+  Code CompileFunc(const FuncAST &ast);
+  Code CompileFunCall(const FunCallAST &ast);
+  // try to compile call of builtin function, returns empty code if failed
+  Code CompileBuiltinCall(const FunCallAST &ast, const CodeList &args);
+
+  // call function value with arguments
+  static Value CallValue(Interpreter &intp, const Value &callee,
+                         const Value *args, std::size_t arg_count,
+                         bool is_tail);
+
+  Interpreter &intp_;
+};
+
+}  // namespace ionia
+
+#endif  // IONIA_BACK_INTERPRETER_CLOSURE_H_
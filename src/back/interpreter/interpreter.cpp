@@ -5,15 +5,26 @@
 #include <functional>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+
+#include <sys/resource.h>
 
 #include "define/ast.h"
+#include "define/intern.h"
+#include "back/interpreter/closure.h"
 
 using namespace ionia;
 
 namespace {
 
-inline FuncAST *FuncCast(const ValPtr &val) {
-  return dynamic_cast<FuncAST *>(val->func_val().get());
+// argument names of pseudo functions
+// arguments are passed to pseudo functions directly in order
+const SymId kArgV = InternId("v"), kArgC = InternId("c"),
+            kArgT = InternId("t"), kArgE = InternId("e"),
+            kArgL = InternId("l"), kArgR = InternId("r");
+
+inline const FuncAST *FuncCast(const Value &val) {
+  return dynamic_cast<const FuncAST *>(val.func_val().get());
 }
 
 template <typename Obj, typename Func, typename... Args>
@@ -22,8 +33,8 @@ inline void AddFuncToEnv(const EnvPtr &env, const char *id,
                          Args... other) {
   using namespace std::placeholders;
   auto obj_func = std::bind(func, obj, _1, other...);
-  auto fun = std::make_unique<PseudoFuncAST>(args, obj_func);
-  env->AddSymbol(id, std::make_shared<Value>(env, std::move(fun)));
+  auto fun = std::make_shared<PseudoFuncAST>(args, obj_func);
+  env->AddSymbol(InternId(id), Value(env, std::move(fun)));
 }
 
 }  // namespace
@@ -31,17 +42,19 @@ inline void AddFuncToEnv(const EnvPtr &env, const char *id,
 void Interpreter::InitEnvironment() {
   auto env = std::make_shared<Environment>();
   // create pseudo functions
-  AddFuncToEnv(env, "<<<", {"v"}, this, &Interpreter::IonPrint);
+  AddFuncToEnv(env, "<<<", {kArgV}, this, &Interpreter::IonPrint);
   AddFuncToEnv(env, ">>>", {}, this, &Interpreter::IonInput);
-  AddFuncToEnv(env, "?", {"c", "t", "e"}, this, &Interpreter::IonIf);
-  AddFuncToEnv(env, "is", {"l", "r"}, this, &Interpreter::IonIs);
+  AddFuncToEnv(env, "?", {kArgC, kArgT, kArgE}, this, &Interpreter::IonIf);
+  AddFuncToEnv(env, "is", {kArgL, kArgR}, this, &Interpreter::IonIs);
   // create pseudo functions (operators)
   auto add_op = [this, &env](const char *id, Operator op, bool unary) {
+    builtin_ops_[InternId(id)] = op;
     if (unary) {
-      AddFuncToEnv(env, id, {"l"}, this, &Interpreter::IonCalcOp, op);
+      AddFuncToEnv(env, id, {kArgL}, this, &Interpreter::IonCalcOp, op);
     }
     else {
-      AddFuncToEnv(env, id, {"l", "r"}, this, &Interpreter::IonCalcOp, op);
+      AddFuncToEnv(env, id, {kArgL, kArgR}, this, &Interpreter::IonCalcOp,
+                   op);
     }
   };
   add_op("eq", Operator::Equal, false);
@@ -66,148 +79,205 @@ void Interpreter::InitEnvironment() {
   add_op("!", Operator::LogicNot, true);
   // do initialize
   root_ = std::move(env);
-  envs_.push(std::make_shared<Environment>(root_));
+  global_ = std::make_shared<Environment>(root_);
+  envs_.push(global_);
 }
 
-ValPtr Interpreter::PrintError(const char *message) {
+Value Interpreter::PrintError(const char *message) {
   std::cerr << "error(interpreter): " << message << std::endl;
   ++error_num_;
-  return nullptr;
+  return Value();
+}
+
+std::uintptr_t Interpreter::GetMaxStackSize() {
+  // default stack size of main thread is usually 8 MiB
+  std::uintptr_t size = 8 * 1024 * 1024;
+  rlimit limit;
+  if (!getrlimit(RLIMIT_STACK, &limit) && limit.rlim_cur != RLIM_INFINITY) {
+    size = limit.rlim_cur;
+  }
+  // leave a quarter for frames outside of evaluation and builtins
+  return size / 4 * 3;
 }
 
-ValPtr Interpreter::CallFunc(const ValPtr &func, const ValPtrList &args) {
+Value Interpreter::CallFunc(const Value &func, const Value *args,
+                            std::size_t arg_count) {
+  // non-tail calls are nested on native stack, so limit its usage
+  char pos;
+  auto cur = reinterpret_cast<std::uintptr_t>(&pos);
+  auto used = cur < stack_base_ ? stack_base_ - cur : cur - stack_base_;
+  if (used > max_stack_size_) {
+    return PrintError("maximum recursion depth exceeded");
+  }
+  // enter function, then perform all pending tail calls
+  auto ret = TailCall(func, args, arg_count);
+  while (has_tail_call_) {
+    has_tail_call_ = false;
+    envs_.push(std::move(tail_env_));
+    // function has been checked by 'TailCall'
+    auto func_ptr = static_cast<const FuncAST *>(tail_func_.func_val().get());
+    ret = func_ptr->Call(*this);
+    envs_.pop();
+  }
+  return ret;
+}
+
+Value Interpreter::TailCall(const Value &func, const Value *args,
+                            std::size_t arg_count) {
   // convert to pointer of FuncAST
   auto func_ptr = FuncCast(func);
   if (!func_ptr) return PrintError("calling a non-function");
   // check argument
-  if (args.size() != func_ptr->args().size()) {
+  if (arg_count != func_ptr->args().size()) {
     return PrintError("argument count mismatch");
   }
+  // builtin functions take arguments directly
+  if (func_ptr->is_pseudo()) {
+    return static_cast<const PseudoFuncAST *>(func_ptr)->CallBuiltin(args);
+  }
   // create new nested environment
-  auto args_env = std::make_shared<Environment>(func->env());
-  for (std::size_t i = 0; i < args.size(); ++i) {
-    args_env->AddSymbol(func_ptr->args()[i], args[i]);
+  auto args_env = std::make_shared<Environment>(func.env(),
+                                                func_ptr->slot_count());
+  for (std::size_t i = 0; i < arg_count; ++i) {
+    args_env->SetSlot(func_ptr->arg_slots()[i], args[i]);
   }
-  // call function
-  envs_.push(args_env);
-  auto ret = func_ptr->Call(*this);
-  envs_.pop();
-  return ret;
+  // function body will be evaluated by the innermost 'CallFunc'
+  has_tail_call_ = true;
+  tail_func_ = func;
+  tail_env_ = std::move(args_env);
+  return Value();
 }
 
-ValPtr Interpreter::IonPrint(const EnvPtr &env) {
-  auto val = env->GetValue("v");
+Value Interpreter::IonPrint(const Value *args) {
+  const auto &val = args[0];
   if (!val) return PrintError("invalid argument");
   PrintValue(val);
   return val;
 }
 
-ValPtr Interpreter::IonInput(const EnvPtr &env) {
+Value Interpreter::IonInput(const Value *args) {
   int num;
   std::cin >> num;
-  return std::make_shared<Value>(env, num);
+  return num;
 }
 
-ValPtr Interpreter::IonIf(const EnvPtr &env) {
+Value Interpreter::IonIf(const Value *args) {
   // get arguments
-  auto cond = env->GetValue("c");
-  auto then = env->GetValue("t");
-  auto else_then = env->GetValue("e");
-  if (!cond || cond->is_func() || !then || !then->is_func()
-      || !else_then || !else_then->is_func()) {
+  const auto &cond = args[0], &then = args[1], &else_then = args[2];
+  if (!cond || cond.is_func() || !then || !then.is_func()
+      || !else_then || !else_then.is_func()) {
     return PrintError("invalid argument");
   }
-  // execute 'if' operation
-  return CallFunc(cond->num_val() ? then : else_then, {});
+  // execute 'if' operation, branch is called without nesting
+  return TailCall(cond.num_val() ? then : else_then, nullptr, 0);
 }
 
-ValPtr Interpreter::IonIs(const EnvPtr &env) {
-  auto lhs = env->GetValue("l"), rhs = env->GetValue("r");
+Value Interpreter::IonIs(const Value *args) {
+  const auto &lhs = args[0], &rhs = args[1];
   if (!lhs || !rhs) return PrintError("invalid argument");
-  return std::make_shared<Value>(env, lhs == rhs ? 1 : 0);
+  return lhs.Is(rhs) ? 1 : 0;
 }
 
-ValPtr Interpreter::IonCalcOp(const EnvPtr &env, Operator op) {
-  // get arguments
-  bool arg_err = false;
-  ValPtr lhs = env->GetValue("l"), rhs;
-  arg_err = !lhs || lhs->is_func();
+Value Interpreter::IonCalcOp(const Value *args, Operator op) {
+  if (op == Operator::Not || op == Operator::LogicNot) {
+    return CalcOp(op, args[0], Value());
+  }
+  return CalcOp(op, args[0], args[1]);
+}
+
+Value Interpreter::CalcOp(Operator op, const Value &lhs, const Value &rhs) {
+  // check arguments
+  bool arg_err = !lhs || lhs.is_func();
   if (op != Operator::Not && op != Operator::LogicNot) {
-    rhs = env->GetValue("r");
-    if (!arg_err) arg_err = !rhs || rhs->is_func();
+    if (!arg_err) arg_err = !rhs || rhs.is_func();
   }
   if (arg_err) return PrintError("invalid argument");
   // convert to integer
-  auto l = lhs->num_val(), r = rhs ? rhs->num_val() : 0;
-  auto new_val = [&env](int v) { return std::make_shared<Value>(env, v); };
+  auto l = lhs.num_val(), r = rhs ? rhs.num_val() : 0;
   // do calculation
   switch (op) {
-    case Operator::Equal: return new_val(l == r);
-    case Operator::NotEqual: return new_val(l != r);
-    case Operator::Less: return new_val(l < r);
-    case Operator::LessEqual: return new_val(l <= r);
-    case Operator::Great: return new_val(l > r);
-    case Operator::GreatEqual: return new_val(l >= r);
-    case Operator::Add: return new_val(l + r);
-    case Operator::Sub: return new_val(l - r);
-    case Operator::Mul: return new_val(l * r);
-    case Operator::Div: return new_val(l / r);
-    case Operator::Mod: return new_val(l % r);
-    case Operator::And: return new_val(l & r);
-    case Operator::Or: return new_val(l | r);
-    case Operator::Not: return new_val(~l);
-    case Operator::Xor: return new_val(l ^ r);
-    case Operator::Shl: return new_val(l << r);
-    case Operator::Shr: return new_val(l >> r);
-    case Operator::LogicAnd: return new_val(l && r);
-    case Operator::LogicOr: return new_val(l || r);
-    case Operator::LogicNot: return new_val(!l);
-    default: return nullptr;
+    case Operator::Equal: return Value(l == r);
+    case Operator::NotEqual: return Value(l != r);
+    case Operator::Less: return Value(l < r);
+    case Operator::LessEqual: return Value(l <= r);
+    case Operator::Great: return Value(l > r);
+    case Operator::GreatEqual: return Value(l >= r);
+    case Operator::Add: return Value(l + r);
+    case Operator::Sub: return Value(l - r);
+    case Operator::Mul: return Value(l * r);
+    case Operator::Div: return Value(l / r);
+    case Operator::Mod: return Value(l % r);
+    case Operator::And: return Value(l & r);
+    case Operator::Or: return Value(l | r);
+    case Operator::Not: return Value(~l);
+    case Operator::Xor: return Value(l ^ r);
+    case Operator::Shl: return Value(l << r);
+    case Operator::Shr: return Value(l >> r);
+    case Operator::LogicAnd: return Value(l && r);
+    case Operator::LogicOr: return Value(l || r);
+    case Operator::LogicNot: return Value(!l);
+    default: return Value();
   }
 }
 
-ValPtr Interpreter::EvalNext(const ASTPtr &ast) {
+Value Interpreter::EvalNext(const ASTPtr &ast) {
   assert(ast);
-  return ast->Eval(*this);
+  auto resolved = resolver_.Resolve(ast);
+  // record position of native stack
+  char pos;
+  stack_base_ = reinterpret_cast<std::uintptr_t>(&pos);
+  if (closure_compile_) return ClosureCompiler(*this).Compile(resolved)();
+  return resolved->Eval(*this);
 }
 
-ValPtr Interpreter::EvalId(const std::string &id) {
-  auto value = envs_.top()->GetValue(id);
+Value Interpreter::EvalId(SymId id, const EnvSlotList &slots) {
+  // find in function environments
+  auto env = envs_.top().get();
+  std::uint32_t depth = 0;
+  for (const auto &slot : slots) {
+    for (; depth < slot.depth; ++depth) env = env->outer().get();
+    if (const auto &value = env->GetSlot(slot.index)) return value;
+  }
+  // find in global environment
+  auto value = global_->GetValue(id);
   if (!value) return PrintError("identifier not found");
   return value;
 }
 
-ValPtr Interpreter::EvalNum(int num) {
-  return std::make_shared<Value>(envs_.top(), num);
+Value Interpreter::EvalNum(int num) {
+  return num;
 }
 
-ValPtr Interpreter::EvalDefine(const std::string &id, const ValPtr &expr) {
-  envs_.top()->AddSymbol(id, expr);
+Value Interpreter::EvalDefine(SymId id, std::uint32_t slot,
+                               const Value &expr) {
+  if (slot == kGlobalSlot) {
+    envs_.top()->AddSymbol(id, expr);
+  }
+  else {
+    envs_.top()->SetSlot(slot, expr);
+  }
   return expr;
 }
 
-ValPtr Interpreter::EvalFunc(ASTPtr func) {
-  return std::make_shared<Value>(envs_.top(), std::move(func));
+Value Interpreter::EvalFunc(ASTPtr func) {
+  return Value(envs_.top(), std::move(func));
 }
 
-ValPtr Interpreter::EvalFunCall(const ValPtr &callee,
-                                const ValPtrList &args) {
+Value Interpreter::EvalFunCall(const Value &callee, const Value *args,
+                                std::size_t arg_count, bool is_tail) {
   // get & check function
-  if (!callee || !callee->is_func()) return PrintError("invalid function");
-  return CallFunc(callee, args);
-}
-
-ValPtr Interpreter::HandlePseudoFunCall(ValCallback func) {
-  return func(envs_.top());
+  if (!callee || !callee.is_func()) return PrintError("invalid function");
+  if (is_tail) return TailCall(callee, args, arg_count);
+  return CallFunc(callee, args, arg_count);
 }
 
-void Interpreter::PrintValue(const ValPtr &value) {
-  if (value->is_func()) {
+void Interpreter::PrintValue(const Value &value) {
+  if (value.is_func()) {
     std::cout << "<function at: ";
-    std::cout << value->func_val().get();
+    std::cout << value.func_val().get();
     std::cout << ">" << std::endl;
   }
   else {
-    std::cout << value->num_val() << std::endl;
+    std::cout << value.num_val() << std::endl;
   }
 }
@@ -3,32 +3,48 @@
 
 #include <string>
 #include <stack>
+#include <map>
+#include <cstddef>
+#include <cstdint>
 
 #include "define/ast.h"
 #include "define/symbol.h"
+#include "back/interpreter/resolver.h"
 
 namespace ionia {
 
 class Interpreter {
  public:
-  Interpreter() : error_num_(0) {
+  Interpreter()
+      : error_num_(0), closure_compile_(false), stack_base_(0),
+        max_stack_size_(GetMaxStackSize()), has_tail_call_(false) {
     InitEnvironment();
   }
 
-  ValPtr EvalNext(const ASTPtr &ast);
-  ValPtr EvalId(const std::string &id);
-  ValPtr EvalNum(int num);
-  ValPtr EvalDefine(const std::string &id, const ValPtr &expr);
-  ValPtr EvalFunc(ASTPtr func);
-  ValPtr EvalFunCall(const ValPtr &callee, const ValPtrList &args);
-  ValPtr HandlePseudoFunCall(ValCallback func);
+  Value EvalNext(const ASTPtr &ast);
+  Value EvalId(SymId id, const EnvSlotList &slots);
+  Value EvalNum(int num);
+  Value EvalDefine(SymId id, std::uint32_t slot, const Value &expr);
+  Value EvalFunc(ASTPtr func);
+  Value EvalFunCall(const Value &callee, const Value *args,
+                    std::size_t arg_count, bool is_tail);
 
-  void PrintValue(const ValPtr &value);
+  void PrintValue(const Value &value);
 
+  // setters
+  // compile statements to closures before evaluating them
+  void set_closure_compile(bool closure_compile) {
+    closure_compile_ = closure_compile;
+  }
+
+  // getters
   unsigned int error_num() const { return error_num_; }
   const EnvPtr &root() const { return root_; }
 
  private:
+  // closure compiler accesses environments and builtins directly
+  friend class ClosureCompiler;
+
   enum class Operator {
     Equal, NotEqual, Less, LessEqual, Great, GreatEqual,
     Add, Sub, Mul, Div, Mod,
@@ -36,19 +52,41 @@ class Interpreter {
     LogicAnd, LogicOr, LogicNot,
   };
 
+  // get max size of native stack that can be used by nested calls
+  static std::uintptr_t GetMaxStackSize();
   void InitEnvironment();
-  ValPtr PrintError(const char *message);
-  ValPtr CallFunc(const ValPtr &func, const ValPtrList &args);
+  Value PrintError(const char *message);
+  Value CallFunc(const Value &func, const Value *args,
+                 std::size_t arg_count);
+  // make a tail call, builtin functions are called immediately,
+  // others will be called by the innermost 'CallFunc' after
+  // current function returns
+  Value TailCall(const Value &func, const Value *args,
+                 std::size_t arg_count);
+  // calculate result of operator
+  Value CalcOp(Operator op, const Value &lhs, const Value &rhs);
 
   // internal functions of ion lang
-  ValPtr IonPrint(const EnvPtr &env);
-  ValPtr IonInput(const EnvPtr &env);
-  ValPtr IonIf(const EnvPtr &env);
-  ValPtr IonIs(const EnvPtr &env);
-  ValPtr IonCalcOp(const EnvPtr &env, Operator op);
+  Value IonPrint(const Value *args);
+  Value IonInput(const Value *args);
+  Value IonIf(const Value *args);
+  Value IonIs(const Value *args);
+  Value IonCalcOp(const Value *args, Operator op);
 
   unsigned int error_num_;
-  EnvPtr root_;
+  bool closure_compile_;
+  // position of native stack when evaluation started & max size
+  // of native stack used by nested calls
+  std::uintptr_t stack_base_, max_stack_size_;
+  // pending tail call
+  bool has_tail_call_;
+  Value tail_func_;
+  EnvPtr tail_env_;
+  Resolver resolver_;
+  // symbols of builtin operators
+  std::map<SymId, Operator> builtin_ops_;
+  // environment of builtin functions and global variables
+  EnvPtr root_, global_;
   std::stack<EnvPtr> envs_;
 };
 
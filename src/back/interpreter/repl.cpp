@@ -4,12 +4,14 @@
 #include <iostream>
 #include <string>
 #include <cstdlib>
+#include <memory>
 
 #include "readline/readline.h"
 #include "readline/history.h"
 
 #include "front/lexer.h"
 #include "front/parser.h"
+#include "define/intern.h"
 
 using namespace ionia;
 
@@ -30,17 +32,53 @@ void REPL::Run() {
     auto ast = parser.ParseNext();
     if (!ast) continue;
     // evaluate and print
-    auto val = ast->Eval(intp_);
-    if (!val) continue;
-    // print value
-    if (print_value_) {
-      auto value_name = "$" + std::to_string(value_num_++);
-      std::cout << value_name << " = ";
-      intp_.PrintValue(val);
-      // add last value to root environment
-      intp_.root()->AddSymbol(value_name, val);
+    if (vm_) {
+      EvalWithVM(ast);
+    }
+    else {
+      EvalWithInterpreter(ast);
     }
   }
   // print new line after EOF
   std::cout << std::endl;
 }
+
+std::string REPL::GetValueName() const {
+  return "$" + std::to_string(value_num_);
+}
+
+void REPL::EvalWithInterpreter(const ASTPtr &ast) {
+  auto val = intp_->EvalNext(ast);
+  if (!val || !print_value_) return;
+  // print value
+  auto value_name = GetValueName();
+  ++value_num_;
+  std::cout << value_name << " = ";
+  intp_->PrintValue(val);
+  // add last value to root environment
+  intp_->root()->AddSymbol(InternId(value_name), val);
+}
+
+void REPL::EvalWithVM(const ASTPtr &ast) {
+  // last value is bound by compiling the statement as a definition
+  auto stmt = ast;
+  if (print_value_) {
+    stmt = std::make_shared<DefineAST>(InternId(GetValueName()), ast);
+  }
+  // compile and run the new code only
+  std::uint32_t entry;
+  if (!comp_->CompileIncremental(stmt, entry)) {
+    std::cerr << "statement is too large for register-based VM";
+    std::cerr << std::endl;
+    return;
+  }
+  if (!vm_->AppendProgram(comp_->code_gen(), entry)) {
+    std::cerr << "invalid bytecode" << std::endl;
+    return;
+  }
+  if (!vm_->Run() || !print_value_) return;
+  // print value
+  std::cout << GetValueName() << " = ";
+  ++value_num_;
+  vm_->PrintValue(vm_->val_reg());
+}
@@ -1,14 +1,24 @@
 #ifndef IONIA_BACK_INTERPRETER_REPL_H_
 #define IONIA_BACK_INTERPRETER_REPL_H_
 
+#include <string>
+
+#include "define/ast.h"
 #include "back/interpreter/interpreter.h"
+#include "back/compiler/compiler.h"
+#include "vm/vm.h"
 
 namespace ionia {
 
 class REPL {
  public:
+  // REPL that evaluates statements with interpreter
   REPL(Interpreter &intp)
-      : intp_(intp), print_value_(false),
+      : intp_(&intp), comp_(nullptr), vm_(nullptr), print_value_(false),
+        prompt_("ionia> "), value_num_(0) {}
+  // REPL that compiles statements incrementally and runs them with VM
+  REPL(Compiler &comp, vm::VM &vm)
+      : intp_(nullptr), comp_(&comp), vm_(&vm), print_value_(false),
         prompt_("ionia> "), value_num_(0) {}
 
   void Run();
@@ -18,7 +28,15 @@ class REPL {
   void set_prompt(const char *prompt) { prompt_ = prompt; }
 
  private:
-  Interpreter &intp_;
+  // get name of the next value
+  std::string GetValueName() const;
+  // evaluate statement and print its value
+  void EvalWithInterpreter(const ASTPtr &ast);
+  void EvalWithVM(const ASTPtr &ast);
+
+  Interpreter *intp_;
+  Compiler *comp_;
+  vm::VM *vm_;
   bool print_value_;
   const char *prompt_;
   unsigned int value_num_;
@@ -0,0 +1,115 @@
+#include "back/interpreter/resolver.h"
+
+#include <utility>
+#include <cassert>
+
+using namespace ionia;
+
+namespace {
+
+// collect all definitions in expression, except ones in functions
+void CollectDefines(const ASTPtr &ast, std::vector<SymId> &defs) {
+  if (auto def = dynamic_cast<const DefineAST *>(ast.get())) {
+    defs.push_back(def->id());
+    CollectDefines(def->expr(), defs);
+  }
+  else if (auto call = dynamic_cast<const FunCallAST *>(ast.get())) {
+    CollectDefines(call->callee(), defs);
+    for (const auto &i : call->args()) CollectDefines(i, defs);
+  }
+}
+
+}  // namespace
+
+ASTPtr Resolver::Resolve(const ASTPtr &ast) {
+  assert(scopes_.empty());
+  // nodes of previous statements hold their own arenas
+  alloc_ = util::ArenaAllocator<BaseAST>::NewArena();
+  auto ret = ResolveAST(ast);
+  alloc_ = util::ArenaAllocator<BaseAST>();
+  return ret;
+}
+
+ASTPtr Resolver::ResolveAST(const ASTPtr &ast) {
+  if (auto id = dynamic_cast<const IdAST *>(ast.get())) {
+    return ResolveId(*id);
+  }
+  else if (auto def = dynamic_cast<const DefineAST *>(ast.get())) {
+    return ResolveDefine(*def);
+  }
+  else if (auto func = dynamic_cast<const FuncAST *>(ast.get())) {
+    return ResolveFunc(*func);
+  }
+  else if (auto call = dynamic_cast<const FunCallAST *>(ast.get())) {
+    return ResolveFunCall(*call);
+  }
+  else {
+    return ast;
+  }
+}
+
+ASTPtr Resolver::ResolveId(const IdAST &ast) {
+  // find in all enclosing scopes from inside out
+  EnvSlotList slots;
+  for (std::size_t i = 0; i < scopes_.size(); ++i) {
+    const auto &scope = scopes_[scopes_.size() - 1 - i];
+    auto it = scope.slots.find(ast.id());
+    if (it == scope.slots.end()) continue;
+    slots.push_back({static_cast<std::uint32_t>(i), it->second});
+    // outer slots are unreachable
+    if (scope.args.count(ast.id())) break;
+  }
+  if (slots.empty()) return ast.shared_from_this();
+  return MakeAST<IdAST>(ast.id(), std::move(slots));
+}
+
+ASTPtr Resolver::ResolveDefine(const DefineAST &ast) {
+  auto expr = ResolveAST(ast.expr());
+  if (scopes_.empty()) {
+    // global definition needs no slot
+    if (expr == ast.expr()) return ast.shared_from_this();
+    return MakeAST<DefineAST>(ast.id(), std::move(expr));
+  }
+  auto slot = scopes_.back().slots.at(ast.id());
+  return MakeAST<DefineAST>(ast.id(), std::move(expr), slot);
+}
+
+ASTPtr Resolver::ResolveFunc(const FuncAST &ast) {
+  // allocate slots for arguments and definitions
+  Scope scope;
+  std::vector<std::uint32_t> arg_slots;
+  auto add_slot = [&scope](SymId id) {
+    auto slot = static_cast<std::uint32_t>(scope.slots.size());
+    return scope.slots.insert({id, slot}).first->second;
+  };
+  for (const auto &i : ast.args()) {
+    arg_slots.push_back(add_slot(i));
+    scope.args.insert(i);
+  }
+  std::vector<SymId> defs;
+  CollectDefines(ast.expr(), defs);
+  for (const auto &i : defs) add_slot(i);
+  auto slot_count = static_cast<std::uint32_t>(scope.slots.size());
+  // resolve function body
+  scopes_.push_back(std::move(scope));
+  auto expr = ResolveAST(ast.expr());
+  scopes_.pop_back();
+  // mark function call in tail position
+  if (auto call = dynamic_cast<const FunCallAST *>(expr.get())) {
+    expr = MakeAST<FunCallAST>(call->callee(), call->args(), true);
+  }
+  return MakeAST<FuncAST>(ast.args(), std::move(expr), slot_count,
+                          std::move(arg_slots));
+}
+
+ASTPtr Resolver::ResolveFunCall(const FunCallAST &ast) {
+  auto callee = ResolveAST(ast.callee());
+  auto changed = callee != ast.callee();
+  ASTPtrList args(alloc_);
+  for (const auto &i : ast.args()) {
+    args.push_back(ResolveAST(i));
+    changed = changed || args.back() != i;
+  }
+  if (!changed) return ast.shared_from_this();
+  return MakeAST<FunCallAST>(std::move(callee), std::move(args));
+}
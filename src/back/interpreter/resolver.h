@@ -0,0 +1,58 @@
+#ifndef IONIA_BACK_INTERPRETER_RESOLVER_H_
+#define IONIA_BACK_INTERPRETER_RESOLVER_H_
+
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <utility>
+#include <cstdint>
+
+#include "define/ast.h"
+#include "util/arena.h"
+
+namespace ionia {
+
+// resolve variables in statement to slots of interpreter environments
+// returns a new AST, subtrees that need no resolution are shared,
+// and new nodes are allocated in a new arena of each statement
+//
+// definitions in function body are only visible after they have been
+// evaluated, so an identifier may be resolved to several slots, the
+// first non-empty one will be used by interpreter
+class Resolver {
+ public:
+  // resolve statement in global scope
+  ASTPtr Resolve(const ASTPtr &ast);
+
+ private:
+  // scope of function
+  struct Scope {
+    // slot index of all local variables
+    std::map<SymId, std::uint32_t> slots;
+    // arguments of function, they are always set when function is called
+    std::set<SymId> args;
+  };
+
+  // create a new AST node in arena
+  template <typename T, typename... Args>
+  ASTPtr MakeAST(Args &&... args) {
+    return std::allocate_shared<T>(util::ArenaAllocator<T>(alloc_),
+                                   std::forward<Args>(args)...);
+  }
+
+  ASTPtr ResolveAST(const ASTPtr &ast);
+  ASTPtr ResolveId(const IdAST &ast);
+  ASTPtr ResolveDefine(const DefineAST &ast);
+  ASTPtr ResolveFunc(const FuncAST &ast);
+  ASTPtr ResolveFunCall(const FunCallAST &ast);
+
+  // scopes of all enclosing functions, the last one is the innermost
+  std::vector<Scope> scopes_;
+  // allocator of nodes and lists in the current statement
+  util::ArenaAllocator<BaseAST> alloc_;
+};
+
+}  // namespace ionia
+
+#endif  // IONIA_BACK_INTERPRETER_RESOLVER_H_
@@ -3,98 +3,78 @@
 #include "back/compiler/compiler.h"
 
 #include <iostream>
+#include <cstddef>
 
 using namespace ionia;
 
-// method 'Clone'
-
-ASTPtr IdAST::Clone() {
-  return std::make_unique<IdAST>(id_);
-}
-
-ASTPtr NumAST::Clone() {
-  return std::make_unique<NumAST>(num_);
-}
-
-ASTPtr DefineAST::Clone() {
-  return std::make_unique<DefineAST>(id_, expr_->Clone());
-}
-
-ASTPtr FuncAST::Clone() {
-  return std::make_unique<FuncAST>(args_, expr_->Clone());
-}
-
-ASTPtr PseudoFuncAST::Clone() {
-  auto func = static_cast<FuncAST *>(this);
-  return std::make_unique<PseudoFuncAST>(func->args(), func_);
-}
-
-ASTPtr FunCallAST::Clone() {
-  ASTPtrList args;
-  for (const auto &i : args_) {
-    args.push_back(i->Clone());
-  }
-  return std::make_unique<FunCallAST>(callee_->Clone(), std::move(args));
+void FuncAST::InitSlots() {
+  slot_count_ = args_.size();
+  for (std::uint32_t i = 0; i < slot_count_; ++i) arg_slots_.push_back(i);
 }
 
 // method 'Eval'
 
-ValPtr IdAST::Eval(Interpreter &intp) {
-  return intp.EvalId(id_);
+Value IdAST::Eval(Interpreter &intp) const {
+  return intp.EvalId(id_, slots_);
 }
 
-ValPtr NumAST::Eval(Interpreter &intp) {
+Value NumAST::Eval(Interpreter &intp) const {
   return intp.EvalNum(num_);
 }
 
-ValPtr DefineAST::Eval(Interpreter &intp) {
+Value DefineAST::Eval(Interpreter &intp) const {
   auto value = expr_->Eval(intp);
-  if (!value) return nullptr;
-  return intp.EvalDefine(id_, value);
+  if (!value) return Value();
+  return intp.EvalDefine(id_, slot_, value);
 }
 
-ValPtr FuncAST::Eval(Interpreter &intp) {
-  return intp.EvalFunc(Clone());
+Value FuncAST::Eval(Interpreter &intp) const {
+  // closure refers to this node directly
+  return intp.EvalFunc(shared_from_this());
 }
 
-ValPtr FunCallAST::Eval(Interpreter &intp) {
-  ValPtrList args;
-  for (const auto &i : args_) {
-    auto val = i->Eval(intp);
-    if (!val) return nullptr;
-    args.push_back(val);
+Value FunCallAST::Eval(Interpreter &intp) const {
+  // arguments are stored on stack if there are only a few of them
+  constexpr std::size_t kMaxStackArgs = 4;
+  Value stack_args[kMaxStackArgs];
+  ValueList heap_args;
+  auto args = stack_args;
+  if (args_.size() > kMaxStackArgs) {
+    heap_args.resize(args_.size());
+    args = heap_args.data();
   }
-  return intp.EvalFunCall(callee_->Eval(intp), args);
+  for (std::size_t i = 0; i < args_.size(); ++i) {
+    args[i] = args_[i]->Eval(intp);
+    if (!args[i]) return Value();
+  }
+  return intp.EvalFunCall(callee_->Eval(intp), args, args_.size(),
+                          is_tail_);
 }
 
 // method 'Call'
 
-ValPtr FuncAST::Call(Interpreter &intp) {
+Value FuncAST::Call(Interpreter &intp) const {
   return expr_->Eval(intp);
 }
 
-ValPtr PseudoFuncAST::Call(Interpreter &intp) {
-  return intp.HandlePseudoFunCall(func_);
-}
-
 // method 'Compile'
 
-void IdAST::Compile(Compiler &comp) {
+void IdAST::Compile(Compiler &comp) const {
   comp.CompileId(id_);
 }
 
-void NumAST::Compile(Compiler &comp) {
+void NumAST::Compile(Compiler &comp) const {
   comp.CompileNum(num_);
 }
 
-void DefineAST::Compile(Compiler &comp) {
+void DefineAST::Compile(Compiler &comp) const {
   comp.CompileDefine(id_, expr_);
 }
 
-void FuncAST::Compile(Compiler &comp) {
+void FuncAST::Compile(Compiler &comp) const {
   comp.CompileFunc(args_, expr_);
 }
 
-void FunCallAST::Compile(Compiler &comp) {
+void FunCallAST::Compile(Compiler &comp) const {
   comp.CompileFunCall(callee_, args_);
 }
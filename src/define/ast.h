@@ -2,7 +2,9 @@
 #define IONIA_DEFINE_AST_H_
 
 #include <utility>
-#include <string>
+#include <memory>
+#include <vector>
+#include <cstdint>
 
 #include "define/type.h"
 #include "define/symbol.h"
@@ -13,34 +15,53 @@ namespace ionia {
 class Interpreter;
 class Compiler;
 
-class BaseAST {
+// location of variable in function environments of interpreter,
+// 'depth' is the number of environments to go outward
+struct EnvSlot {
+  std::uint32_t depth, index;
+};
+using EnvSlotList = std::vector<EnvSlot>;
+
+// slot index of definitions in global environment
+constexpr std::uint32_t kGlobalSlot = UINT32_MAX;
+
+// base class of all AST nodes
+// nodes are never modified after construction, so subtrees can be
+// shared between program, closures and compiler without copying
+class BaseAST : public std::enable_shared_from_this<BaseAST> {
  public:
   virtual ~BaseAST() = default;
 
-  virtual ASTPtr Clone() = 0;
-  virtual ValPtr Eval(Interpreter &intp) = 0;
-  virtual void Compile(Compiler &comp) = 0;
+  virtual Value Eval(Interpreter &intp) const = 0;
+  virtual void Compile(Compiler &comp) const = 0;
 };
 
 class IdAST : public BaseAST {
  public:
-  IdAST(const std::string &id) : id_(id) {}
+  IdAST(SymId id) : id_(id) {}
+  IdAST(SymId id, EnvSlotList slots) : id_(id), slots_(std::move(slots)) {}
+
+  Value Eval(Interpreter &intp) const override;
+  void Compile(Compiler &comp) const override;
 
-  ASTPtr Clone() override;
-  ValPtr Eval(Interpreter &intp) override;
-  void Compile(Compiler &comp) override;
+  SymId id() const { return id_; }
+  // slots that may hold the variable, innermost first,
+  // global environment will be searched if all of them are empty
+  const EnvSlotList &slots() const { return slots_; }
 
  private:
-  std::string id_;
+  SymId id_;
+  EnvSlotList slots_;
 };
 
 class NumAST : public BaseAST {
  public:
   NumAST(int num) : num_(num) {}
 
-  ASTPtr Clone() override;
-  ValPtr Eval(Interpreter &intp) override;
-  void Compile(Compiler &comp) override;
+  Value Eval(Interpreter &intp) const override;
+  void Compile(Compiler &comp) const override;
+
+  int num() const { return num_; }
 
  private:
   int num_;
@@ -48,37 +69,64 @@ class NumAST : public BaseAST {
 
 class DefineAST : public BaseAST {
  public:
-  DefineAST(const std::string &id, ASTPtr expr)
-      : id_(id), expr_(std::move(expr)) {}
+  DefineAST(SymId id, ASTPtr expr)
+      : id_(id), expr_(std::move(expr)), slot_(kGlobalSlot) {}
+  DefineAST(SymId id, ASTPtr expr, std::uint32_t slot)
+      : id_(id), expr_(std::move(expr)), slot_(slot) {}
+
+  Value Eval(Interpreter &intp) const override;
+  void Compile(Compiler &comp) const override;
 
-  ASTPtr Clone() override;
-  ValPtr Eval(Interpreter &intp) override;
-  void Compile(Compiler &comp) override;
+  SymId id() const { return id_; }
+  const ASTPtr &expr() const { return expr_; }
+  // slot in current function environment, or 'kGlobalSlot'
+  std::uint32_t slot() const { return slot_; }
 
  private:
-  std::string id_;
+  SymId id_;
   ASTPtr expr_;
+  std::uint32_t slot_;
 };
 
 class FuncAST : public BaseAST {
  public:
   FuncAST(IdList args, ASTPtr expr)
-      : args_(std::move(args)), expr_(std::move(expr)) {}
+      : args_(std::move(args)), expr_(std::move(expr)), is_pseudo_(false) {
+    InitSlots();
+  }
+  FuncAST(IdList args, ASTPtr expr, std::uint32_t slot_count,
+          std::vector<std::uint32_t> arg_slots)
+      : args_(std::move(args)), expr_(std::move(expr)),
+        slot_count_(slot_count), arg_slots_(std::move(arg_slots)),
+        is_pseudo_(false) {}
 
-  virtual ASTPtr Clone() override;
-  ValPtr Eval(Interpreter &intp) override;
-  void Compile(Compiler &comp) override;
+  Value Eval(Interpreter &intp) const override;
+  void Compile(Compiler &comp) const override;
 
-  virtual ValPtr Call(Interpreter &intp);
+  virtual Value Call(Interpreter &intp) const;
 
   const IdList &args() const { return args_; }
+  const ASTPtr &expr() const { return expr_; }
+  // size of environment, and slot index of each argument
+  std::uint32_t slot_count() const { return slot_count_; }
+  const std::vector<std::uint32_t> &arg_slots() const { return arg_slots_; }
+  // check if is a builtin function
+  bool is_pseudo() const { return is_pseudo_; }
 
  protected:
-  FuncAST(IdList args) : args_(std::move(args)) {}
+  FuncAST(IdList args) : args_(std::move(args)), is_pseudo_(true) {
+    InitSlots();
+  }
 
  private:
+  // place arguments in the first slots
+  void InitSlots();
+
   IdList args_;
   ASTPtr expr_;
+  std::uint32_t slot_count_;
+  std::vector<std::uint32_t> arg_slots_;
+  bool is_pseudo_;
 };
 
 class PseudoFuncAST : public FuncAST {
@@ -86,8 +134,8 @@ class PseudoFuncAST : public FuncAST {
   PseudoFuncAST(IdList args, ValCallback func)
       : FuncAST(std::move(args)), func_(func) {}
 
-  ASTPtr Clone() override;
-  ValPtr Call(Interpreter &intp) override;
+  // call builtin function with arguments, no environment is created
+  Value CallBuiltin(const Value *args) const { return func_(args); }
 
  private:
   ValCallback func_;
@@ -96,15 +144,23 @@ class PseudoFuncAST : public FuncAST {
 class FunCallAST : public BaseAST {
  public:
   FunCallAST(ASTPtr callee, ASTPtrList args)
-      : callee_(std::move(callee)), args_(std::move(args)) {}
+      : callee_(std::move(callee)), args_(std::move(args)), is_tail_(false) {}
+  FunCallAST(ASTPtr callee, ASTPtrList args, bool is_tail)
+      : callee_(std::move(callee)), args_(std::move(args)),
+        is_tail_(is_tail) {}
+
+  Value Eval(Interpreter &intp) const override;
+  void Compile(Compiler &comp) const override;
 
-  ASTPtr Clone() override;
-  ValPtr Eval(Interpreter &intp) override;
-  void Compile(Compiler &comp) override;
+  const ASTPtr &callee() const { return callee_; }
+  const ASTPtrList &args() const { return args_; }
+  // check if is the last expression of function body
+  bool is_tail() const { return is_tail_; }
 
  private:
   ASTPtr callee_;
   ASTPtrList args_;
+  bool is_tail_;
 };
 
 }  // ionia
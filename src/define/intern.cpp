@@ -0,0 +1,42 @@
+#include "define/intern.h"
+
+#include <unordered_map>
+#include <deque>
+
+using namespace ionia;
+
+namespace {
+
+// global identifier table
+struct IdTable {
+  IdTable() {
+    // empty identifier is always the first one
+    names.emplace_back();
+    ids.insert({names.back(), kNoId});
+  }
+
+  // names are stored in deque, so views of them are always valid
+  std::unordered_map<std::string_view, SymId> ids;
+  std::deque<std::string> names;
+};
+
+IdTable &GetIdTable() {
+  static IdTable table;
+  return table;
+}
+
+}  // namespace
+
+SymId ionia::InternId(std::string_view id) {
+  auto &table = GetIdTable();
+  auto it = table.ids.find(id);
+  if (it != table.ids.end()) return it->second;
+  auto sym = static_cast<SymId>(table.names.size());
+  table.names.emplace_back(id);
+  table.ids.insert({table.names.back(), sym});
+  return sym;
+}
+
+const std::string &ionia::GetIdName(SymId id) {
+  return GetIdTable().names[id];
+}
@@ -0,0 +1,19 @@
+#ifndef IONIA_DEFINE_INTERN_H_
+#define IONIA_DEFINE_INTERN_H_
+
+#include <string>
+#include <string_view>
+
+#include "define/type.h"
+
+namespace ionia {
+
+// intern identifier into the global identifier table, returns its id
+// the same identifier always gets the same id
+SymId InternId(std::string_view id);
+// get name of interned identifier
+const std::string &GetIdName(SymId id);
+
+}  // namespace ionia
+
+#endif  // IONIA_DEFINE_INTERN_H_
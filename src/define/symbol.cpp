@@ -1,19 +1,20 @@
 #include "define/symbol.h"
-#include "define/ast.h"
-
-#include <iostream>
 
 using namespace ionia;
 
-ValPtr Environment::GetValue(const std::string &id) {
-  auto it = symbols_.find(id);
-  if (it != symbols_.end()) {
-    return it->second;
+void Environment::AddSymbol(SymId id, const Value &value) {
+  if (id >= slots_.size()) slots_.resize(id + 1);
+  slots_[id] = value;
+}
+
+Value Environment::GetValue(SymId id) {
+  if (id < slots_.size() && slots_[id]) {
+    return slots_[id];
   }
   else if (outer_) {
     return outer_->GetValue(id);
   }
   else {
-    return nullptr;
+    return Value();
   }
 }
@@ -2,10 +2,9 @@
 #define IONIA_DEFINE_SYMBOL_H_
 
 #include <memory>
-#include <map>
-#include <string>
 #include <vector>
 #include <functional>
+#include <cstdint>
 
 #include "define/type.h"
 
@@ -14,43 +13,72 @@ namespace ionia {
 class Environment;
 using EnvPtr = std::shared_ptr<Environment>;
 
+// function value, holds the environment where it is created
+struct Closure {
+  EnvPtr env;
+  ASTPtr func;
+};
+
+// value of interpreter, integers are stored inline,
+// only function values are allocated on heap
 class Value {
  public:
-  Value(const EnvPtr &env, int value) : env_(env), num_val_(value) {}
+  // null value, means error or undefined variable
+  Value() : is_num_(false), num_val_(0) {}
+  Value(int value) : is_num_(true), num_val_(value) {}
   Value(const EnvPtr &env, ASTPtr value)
-      : env_(env), func_val_(std::move(value)) {}
+      : is_num_(false), num_val_(0),
+        closure_(std::make_shared<Closure>(Closure{env, std::move(value)})) {}
+
+  // check if is not null
+  explicit operator bool() const { return is_num_ || closure_; }
+  // check if two values are the same integer or the same function
+  bool Is(const Value &other) const {
+    return is_num_ ? other.is_num_ && num_val_ == other.num_val_
+                   : closure_ && closure_ == other.closure_;
+  }
 
-  const EnvPtr &env() const { return env_; }
-  bool is_func() const { return func_val_ != nullptr; }
+  bool is_func() const { return closure_ != nullptr; }
   int num_val() const { return num_val_; }
-  const ASTPtr &func_val() const { return func_val_; }
+  const EnvPtr &env() const { return closure_->env; }
+  const ASTPtr &func_val() const { return closure_->func; }
 
  private:
-  EnvPtr env_;
+  bool is_num_;
   int num_val_;
-  ASTPtr func_val_;
+  std::shared_ptr<const Closure> closure_;
 };
 
-using ValPtr = std::shared_ptr<Value>;
-using ValPtrList = std::vector<ValPtr>;
-using ValCallback = std::function<ValPtr(const EnvPtr &env)>;
+using ValueList = std::vector<Value>;
+// callback of builtin function, takes arguments directly
+using ValCallback = std::function<Value(const Value *args)>;
 
+// environment of interpreter
+// slots of function environment are indexed by slot index that
+// assigned by resolver, slots of global environment are indexed by
+// symbol id of variable
 class Environment {
  public:
   Environment() {}
   Environment(const EnvPtr &outer) : outer_(outer) {}
+  Environment(const EnvPtr &outer, std::uint32_t slot_count)
+      : outer_(outer), slots_(slot_count) {}
 
-  void AddSymbol(const std::string &id, const ValPtr &value) {
-    symbols_[id] = value;
+  // access slots of function environment
+  const Value &GetSlot(std::uint32_t index) const { return slots_[index]; }
+  void SetSlot(std::uint32_t index, const Value &value) {
+    slots_[index] = value;
   }
 
-  ValPtr GetValue(const std::string &id);
+  // access variables of global environment
+  void AddSymbol(SymId id, const Value &value);
+  Value GetValue(SymId id);
 
   const EnvPtr &outer() const { return outer_; }
 
  private:
   EnvPtr outer_;
-  std::map<std::string, ValPtr> symbols_;
+  std::vector<Value> slots_;
 };
 
 }  // namespace ionia
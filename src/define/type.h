@@ -4,14 +4,23 @@
 #include <memory>
 #include <string>
 #include <vector>
+#include <cstdint>
+
+#include "util/arena.h"
 
 namespace ionia {
 
-// AST type
+// identifier type, all identifiers are interned (see 'define/intern.h')
+using SymId = std::uint32_t;
+// id of empty identifier, means no identifier
+constexpr SymId kNoId = 0;
+
+// AST type, nodes are immutable and shared by all their users
 class BaseAST;
-using ASTPtr = std::unique_ptr<BaseAST>;
-using ASTPtrList = std::vector<ASTPtr>;
-using IdList = std::vector<std::string>;
+using ASTPtr = std::shared_ptr<const BaseAST>;
+// lists in AST nodes are allocated in arena of their nodes
+using ASTPtrList = std::vector<ASTPtr, util::ArenaAllocator<ASTPtr>>;
+using IdList = std::vector<SymId, util::ArenaAllocator<SymId>>;
 
 }  // namespace ionia
 
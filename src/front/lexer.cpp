@@ -1,20 +1,73 @@
 #include "front/lexer.h"
 
 #include <iostream>
-#include <cctype>
+#include <array>
+#include <cstdint>
 #include <cstdlib>
 
+#include "define/intern.h"
+
 using namespace ionia;
 
 namespace {
 
-inline bool IsIdChar(char c) {
-  return c != '=' && c != '(' && c != ')' && c != ',' && c != ':' &&
-         !std::isspace(c);
+// classes of characters
+enum CharClass : std::uint8_t {
+  kSpace = 1 << 0, kEOL = 1 << 1, kDigit = 1 << 2, kIdChar = 1 << 3,
+};
+
+constexpr std::array<std::uint8_t, 256> MakeCharTable() {
+  std::array<std::uint8_t, 256> table = {};
+  for (int c = 0; c < 256; ++c) {
+    std::uint8_t cls = 0;
+    if (c == ' ' || c == '\t' || c == '\v' || c == '\f') cls |= kSpace;
+    if (c == '\r' || c == '\n') cls |= kSpace | kEOL;
+    if (c >= '0' && c <= '9') cls |= kDigit;
+    if (!(cls & kSpace) && c != '=' && c != '(' && c != ')' && c != ',' &&
+        c != ':') {
+      cls |= kIdChar;
+    }
+    table[c] = cls;
+  }
+  return table;
+}
+
+// class table of all characters
+constexpr auto kCharTable = MakeCharTable();
+
+inline bool Is(char c, std::uint8_t cls) {
+  return kCharTable[static_cast<std::uint8_t>(c)] & cls;
+}
+
+// skip characters in class, returns the first one that not in class
+inline const char *SkipWhile(const char *cur, const char *end,
+                             std::uint8_t cls) {
+  while (cur != end && Is(*cur, cls)) ++cur;
+  return cur;
+}
+
+// skip characters not in class, returns the first one that in class
+inline const char *SkipUntil(const char *cur, const char *end,
+                             std::uint8_t cls) {
+  while (cur != end && !Is(*cur, cls)) ++cur;
+  return cur;
 }
 
 }  // namespace
 
+bool Lexer::ReadBuffer() {
+  buf_.clear();
+  pos_ = 0;
+  // read in blocks until the end of stream
+  while (in_) {
+    auto size = buf_.size();
+    buf_.resize(size + kBlockSize);
+    in_.read(&buf_[size], kBlockSize);
+    buf_.resize(size + in_.gcount());
+  }
+  return !buf_.empty();
+}
+
 Lexer::Token Lexer::PrintError(const char *message) {
   std::cerr << "error(lexer): " << message << std::endl;
   ++error_num_;
@@ -22,61 +75,47 @@ Lexer::Token Lexer::PrintError(const char *message) {
 }
 
 Lexer::Token Lexer::HandleId() {
-  std::string id;
-  do {
-    id += last_char_;
-    NextChar();
-  } while (!IsEOL() && IsIdChar(last_char_));
-  id_val_ = id;
+  auto begin = buf_.data() + pos_;
+  auto end = SkipWhile(begin, buf_.data() + buf_.size(), kIdChar);
+  pos_ += end - begin;
+  id_val_ = InternId(std::string_view(begin, end - begin));
   return Token::Id;
 }
 
 Lexer::Token Lexer::HandleNum() {
-  std::string num;
-  do {
-    num += last_char_;
-    NextChar();
-  } while (!IsEOL() && std::isdigit(last_char_));
-  char *end_pos;
-  num_val_ = std::strtol(num.c_str(), &end_pos, 10);
-  return *end_pos || (num[0] == '0' && num.size() > 1)
-             ? PrintError("invalid number") : Token::Num;
-}
-
-Lexer::Token Lexer::HandleComment() {
-  NextChar();  // eat '#'
-  while (!IsEOL()) NextChar();
-  return NextToken();
-}
-
-Lexer::Token Lexer::HandleEOL() {
-  do {
-    NextChar();
-  } while (IsEOL() && !in_.eof());
-  return NextToken();
+  auto begin = buf_.data() + pos_;
+  auto end = SkipWhile(begin, buf_.data() + buf_.size(), kDigit);
+  pos_ += end - begin;
+  // buffer is null-terminated, and digits are followed by a non-digit
+  num_val_ = std::strtol(begin, nullptr, 10);
+  return *begin == '0' && end - begin > 1 ? PrintError("invalid number")
+                                          : Token::Num;
 }
 
 void Lexer::Reset() {
-  last_char_ = ' ';
+  buf_.clear();
+  pos_ = 0;
   error_num_ = 0;
-  in_ >> std::noskipws;
 }
 
 Lexer::Token Lexer::NextToken() {
-  // end of file
-  if (in_.eof()) return Token::End;
-  // skip spaces
-  while (!IsEOL() && std::isspace(last_char_)) NextChar();
-  // skip comments
-  if (last_char_ == '#') return HandleComment();
+  // skip spaces, line breaks and comments
+  for (;;) {
+    // end of file
+    if (pos_ >= buf_.size() && !ReadBuffer()) return Token::End;
+    auto begin = buf_.data(), end = begin + buf_.size();
+    auto cur = SkipWhile(begin + pos_, end, kSpace);
+    if (cur != end && *cur == '#') cur = SkipUntil(cur, end, kEOL);
+    pos_ = cur - begin;
+    if (cur != end && !Is(*cur, kSpace)) break;
+  }
+  auto c = buf_[pos_];
   // number
-  if (std::isdigit(last_char_)) return HandleNum();
+  if (Is(c, kDigit)) return HandleNum();
   // identifier
-  if (IsIdChar(last_char_)) return HandleId();
-  // end of line
-  if (IsEOL()) return HandleEOL();
+  if (Is(c, kIdChar)) return HandleId();
   // other characters
-  char_val_ = last_char_;
-  NextChar();
+  char_val_ = c;
+  ++pos_;
   return Token::Char;
 }
@@ -3,9 +3,14 @@
 
 #include <istream>
 #include <string>
+#include <cstddef>
+
+#include "define/type.h"
 
 namespace ionia {
 
+// lexer of Ionia, reads the rest of input stream into a buffer
+// in large blocks, and then scans the buffer directly
 class Lexer {
  public:
   enum class Token { End, Error, Id, Num, Char };
@@ -16,26 +21,28 @@ class Lexer {
   Token NextToken();
 
   unsigned int error_num() const { return error_num_; }
-  const std::string &id_val() const { return id_val_; }
+  // interned identifier
+  SymId id_val() const { return id_val_; }
   int num_val() const { return num_val_; }
   char char_val() const { return char_val_; }
 
  private:
-  void NextChar() { in_ >> last_char_; }
-  bool IsEOL() {
-    return in_.eof() || last_char_ == '\r' || last_char_ == '\n';
-  }
+  // size of each block that read from input stream
+  static constexpr std::size_t kBlockSize = 64 * 1024;
+
+  // drop the buffer and read the rest of input stream,
+  // returns false if there is nothing to read
+  bool ReadBuffer();
 
   Token PrintError(const char *message);
   Token HandleId();
   Token HandleNum();
-  Token HandleComment();
-  Token HandleEOL();
 
   std::istream &in_;
-  char last_char_;
+  std::string buf_;
+  std::size_t pos_;
   unsigned int error_num_;
-  std::string id_val_;
+  SymId id_val_;
   int num_val_;
   char char_val_;
 };
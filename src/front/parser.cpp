@@ -10,13 +10,13 @@ ASTPtr Parser::PrintError(const char *message) {
   return nullptr;
 }
 
-ASTPtr Parser::ParseDefine(const std::string &id) {
+ASTPtr Parser::ParseDefine(SymId id) {
   // eat '='
   NextToken();
   // get expression
   auto expr = ParseExpr();
   if (!expr) return nullptr;
-  return std::make_unique<DefineAST>(id, std::move(expr));
+  return MakeAST<DefineAST>(id, std::move(expr));
 }
 
 ASTPtr Parser::ParseExpr() {
@@ -30,19 +30,19 @@ ASTPtr Parser::ParseExpr() {
         NextToken();
         // check if is function call or define
         if (IsTokenChar('(')) {
-          return ParseFunCall(std::make_unique<IdAST>(id));
+          return ParseFunCall(MakeAST<IdAST>(id));
         }
         else if (IsTokenChar('=')) {
           return ParseDefine(id);
         }
         else {
-          return std::make_unique<IdAST>(id);
+          return MakeAST<IdAST>(id);
         }
       }
       case Token::Num: {
         auto num = lexer_.num_val();
         NextToken();
-        return std::make_unique<NumAST>(num);
+        return MakeAST<NumAST>(num);
       }
       default:;
     }
@@ -54,7 +54,7 @@ ASTPtr Parser::ParseFunc() {
   // eat '('
   NextToken();
   // read argument list
-  IdList args;
+  IdList args(alloc_);
   if (cur_token_ == Token::Id) {
     args.push_back(lexer_.id_val());
     NextToken();
@@ -75,14 +75,14 @@ ASTPtr Parser::ParseFunc() {
   // get expression
   auto expr = ParseExpr();
   if (!expr) return nullptr;
-  return std::make_unique<FuncAST>(std::move(args), std::move(expr));
+  return MakeAST<FuncAST>(std::move(args), std::move(expr));
 }
 
 ASTPtr Parser::ParseFunCall(ASTPtr callee) {
   // eat '('
   NextToken();
   // get arguments
-  ASTPtrList args;
+  ASTPtrList args(alloc_);
   if (!IsTokenChar(')')) {
     // get first argument
     auto expr = ParseExpr();
@@ -100,8 +100,7 @@ ASTPtr Parser::ParseFunCall(ASTPtr callee) {
   if (!IsTokenChar(')')) return PrintError("expected ')'");
   NextToken();
   // create AST
-  auto ast = std::make_unique<FunCallAST>(std::move(callee),
-                                          std::move(args));
+  auto ast = MakeAST<FunCallAST>(std::move(callee), std::move(args));
   // check if need to continue
   if (IsTokenChar('(')) {
     return ParseFunCall(std::move(ast));
@@ -122,13 +121,15 @@ ASTPtr Parser::ParseNext() {
   if (cur_token_ != Token::Id) return PrintError("expected id");
   auto id = lexer_.id_val();
   NextToken();
+  // nodes of previous statements hold their own arenas
+  alloc_ = util::ArenaAllocator<BaseAST>::NewArena();
   // get statement
   ASTPtr stat;
   if (IsTokenChar('=')) {
     stat = ParseDefine(id);
   }
   else if (IsTokenChar('(')) {
-    stat = ParseFunCall(std::make_unique<IdAST>(id));
+    stat = ParseFunCall(MakeAST<IdAST>(id));
   }
   else {
     return PrintError("invalid statment");
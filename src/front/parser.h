@@ -1,8 +1,12 @@
 #ifndef IONIA_FRONT_PARSER_H_
 #define IONIA_FRONT_PARSER_H_
 
+#include <memory>
+#include <utility>
+
 #include "front/lexer.h"
 #include "define/ast.h"
+#include "util/arena.h"
 
 namespace ionia {
 
@@ -23,8 +27,15 @@ class Parser {
     return cur_token_ == Token::Char && lexer_.char_val() == c;
   }
 
+  // create a new AST node in arena
+  template <typename T, typename... Args>
+  ASTPtr MakeAST(Args &&... args) {
+    return std::allocate_shared<T>(util::ArenaAllocator<T>(alloc_),
+                                   std::forward<Args>(args)...);
+  }
+
   ASTPtr PrintError(const char *message);
-  ASTPtr ParseDefine(const std::string &id);
+  ASTPtr ParseDefine(SymId id);
   ASTPtr ParseExpr();
   ASTPtr ParseFunc();
   ASTPtr ParseFunCall(ASTPtr callee);
@@ -32,6 +43,9 @@ class Parser {
   Lexer &lexer_;
   Token cur_token_;
   unsigned int error_num_;
+  // allocator of nodes and lists in the current statement,
+  // each statement is allocated in its own arena
+  util::ArenaAllocator<BaseAST> alloc_;
 };
 
 }  // namespace ionia
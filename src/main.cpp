@@ -1,8 +1,9 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <iterator>
 #include <functional>
-#include <cassert>
+#include <utility>
 #include <cstring>
 
 #include "version.h"
@@ -10,9 +11,11 @@
 #include "front/parser.h"
 #include "back/interpreter/repl.h"
 #include "back/interpreter/interpreter.h"
+#include "opt/optimizer.h"
 #include "back/compiler/compiler.h"
 #include "vm/vm.h"
 #include "vm/disasm.h"
+#include "vm/cache.h"
 #include "util/argparse.h"
 
 using namespace std;
@@ -42,7 +45,7 @@ int HandleFrondEnd(const std::string &input,
   Lexer lexer(ifs);
   Parser parser(lexer);
   // parse and check
-  int err;
+  int err = 0;
   while (auto ast = parser.ParseNext()) {
     err = func(ast);
     if (err) break;
@@ -52,9 +55,30 @@ int HandleFrondEnd(const std::string &input,
   return err;
 }
 
+// get flavor of VM dispatch loop by name, returns false if invalid
+bool GetVMFlavor(const std::string &name, vm::VM::Flavor &flavor) {
+  if (name == "fast") {
+    flavor = vm::VM::Flavor::Fast;
+  }
+  else if (name == "checked") {
+    flavor = vm::VM::Flavor::Checked;
+  }
+  else if (name == "profiled") {
+    flavor = vm::VM::Flavor::Profiled;
+  }
+  else if (name == "traced") {
+    flavor = vm::VM::Flavor::Traced;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
 // run bytecode file with VM
-int RunBytecode(const std::string &input) {
+int RunBytecode(const std::string &input, vm::VM::Flavor flavor) {
   vm::VM vm;
+  vm.set_flavor(flavor);
   if (!vm.LoadProgram(input)) {
     cerr << "invalid bytecode file" << endl;
     return 1;
@@ -62,21 +86,48 @@ int RunBytecode(const std::string &input) {
   return vm.Run() ? 0 : 1;
 }
 
+// check if all command line arguments are REPL options
+bool IsREPLArgs(int argc, const char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-p") && strcmp(argv[i], "-cc") &&
+        strcmp(argv[i], "-vr") && strcmp(argv[i], "-rg")) {
+      return false;
+    }
+  }
+  return true;
+}
+
 // just run REPL
-void RunREPL(bool print_value) {
+void RunREPL(bool print_value, bool closure_compile) {
   // show version info first
   PrintVersion();
   cout << endl;
   // initialize interpreter & REPL
   Interpreter intp;
+  intp.set_closure_compile(closure_compile);
   REPL repl(intp);
   repl.set_print_value(print_value);
   repl.Run();
 }
 
+// run REPL that compiles each statement and runs it with VM
+void RunVMREPL(bool print_value, vm::CodeMode mode) {
+  // show version info first
+  PrintVersion();
+  cout << endl;
+  // initialize compiler, VM & REPL
+  Compiler comp;
+  comp.set_code_mode(mode);
+  vm::VM vm;
+  REPL repl(comp, vm);
+  repl.set_print_value(print_value);
+  repl.Run();
+}
+
 // interpret input source file by using interpreter
-int Interpret(const std::string &input) {
+int Interpret(const std::string &input, bool closure_compile) {
   Interpreter intp;
+  intp.set_closure_compile(closure_compile);
   // parse and interpret
   auto err = HandleFrondEnd(input, [&intp](const ASTPtr &ast) {
     return intp.EvalNext(ast) ? 0 : intp.error_num();
@@ -84,14 +135,32 @@ int Interpret(const std::string &input) {
   return err;
 }
 
-// compile input source file to output
-int Compile(const std::string &input, const std::string &output) {
-  Compiler comp;
-  // parse and compile
-  auto err = HandleFrondEnd(input, [&comp](const ASTPtr &ast) {
-    comp.CompileNext(ast);
+// parse, optimize and compile input source file, return error count
+int CompileSource(const std::string &input, int opt_level,
+                  Compiler &comp) {
+  Optimizer opt;
+  opt.set_opt_level(opt_level);
+  // parse and buffer all statements
+  auto err = HandleFrondEnd(input, [&opt](const ASTPtr &ast) {
+    opt.AddNext(ast);
     return 0;
   });
+  if (err) return err;
+  // optimize and compile
+  for (const auto &i : opt.Optimize()) comp.CompileNext(i);
+  return 0;
+}
+
+// compile input source file to output
+int Compile(const std::string &input, const std::string &output,
+            int opt_level, bool dump_inline, bool dump_ir,
+            vm::CodeMode mode) {
+  Compiler comp;
+  if (dump_inline) comp.set_inline_dump(&std::cerr);
+  if (dump_ir) comp.set_ir_dump(&std::cerr);
+  comp.set_code_mode(mode);
+  // parse, optimize and compile
+  auto err = CompileSource(input, opt_level, comp);
   // write to output
   if (!err) {
     auto out = output.empty() ? kDefaultOutputFile : output;
@@ -101,20 +170,45 @@ int Compile(const std::string &input, const std::string &output) {
 }
 
 // compile input file to memory and run with VM
-int CompileAndRun(const std::string &input) {
+// compiled program will be cached if 'use_cache' is set
+int CompileAndRun(const std::string &input, int opt_level,
+                  bool dump_inline, bool dump_ir, vm::CodeMode mode,
+                  bool use_cache, vm::VM::Flavor flavor) {
+  vm::VM vm;
+  vm.set_flavor(flavor);
+  vm::Program program;
+  // dumps are only available when compiling
+  auto cache_dir = vm::CompileCache::GetDefaultDir();
+  use_cache = use_cache && !dump_inline && !dump_ir && !cache_dir.empty();
+  vm::CompileCache cache(cache_dir);
+  std::string key;
+  if (use_cache) {
+    // look up in cache by content of source file
+    ifstream ifs(input, ios::binary);
+    std::string source(istreambuf_iterator<char>(ifs), {});
+    key = vm::CompileCache::GetKey(source, opt_level, mode);
+    use_cache = ifs.is_open();
+    if (use_cache && cache.Load(key, program)) {
+      if (vm.LoadProgram(std::move(program))) return vm.Run() ? 0 : 1;
+      // program can not be verified, recompile it
+      cache.Remove(key);
+    }
+  }
   Compiler comp;
-  // parse and compile
-  auto err = HandleFrondEnd(input, [&comp](const ASTPtr &ast) {
-    comp.CompileNext(ast);
-    return 0;
-  });
+  if (dump_inline) comp.set_inline_dump(&std::cerr);
+  if (dump_ir) comp.set_ir_dump(&std::cerr);
+  comp.set_code_mode(mode);
+  // parse, optimize and compile
+  auto err = CompileSource(input, opt_level, comp);
   // check if error
   if (err) return err;
-  // generate and run
-  vm::VM vm;
-  auto ret = vm.LoadProgram(comp.GenerateBytecode());
-  static_cast<void>(ret);
-  assert(ret);
+  // generate, store to cache and run
+  program = comp.GenerateProgram();
+  if (use_cache) cache.Store(key, program);
+  if (!vm.LoadProgram(std::move(program))) {
+    cerr << "invalid bytecode" << endl;
+    return 1;
+  }
   return vm.Run() ? 0 : 1;
 }
 
@@ -149,14 +243,34 @@ int main(int argc, const char *argv[]) {
                        "print value of each expression in REPL", false);
   argp.AddOption<bool>("interpret", "i",
                        "run source file with interpreter (default)", true);
+  argp.AddOption<bool>("closure-compile", "cc",
+                       "compile code to closures before interpreting",
+                       false);
+  argp.AddOption<bool>("vm-repl", "vr",
+                       "run REPL with VM instead of interpreter", false);
   argp.AddOption<bool>("compile", "c", "compile source file to bytecode",
                        false);
   argp.AddOption<string>("output", "o", "set output file name", "");
   argp.AddOption<bool>("run-vm", "r", "run bytecode file with VM", false);
   argp.AddOption<bool>("compile-run", "cr",
                        "compile & run source file with VM", false);
+  argp.AddOption<bool>("no-cache", "nc",
+                       "do not use compile cache when compiling & running",
+                       false);
+  argp.AddOption<string>("vm-flavor", "vf",
+                         "set flavor of VM (fast/checked/profiled/traced)",
+                         "fast");
   argp.AddOption<bool>("disassemble", "d", "disassemble bytecode file",
                        false);
+  argp.AddOption<int>("opt-level", "O",
+                      "set optimization level of compiler (0-2)", 0);
+  argp.AddOption<bool>("dump-inline", "di",
+                       "dump inlining decisions of compiler", false);
+  argp.AddOption<bool>("dump-ir", "dir",
+                       "dump intermediate representation of compiler",
+                       false);
+  argp.AddOption<bool>("register", "rg",
+                       "generate bytecode of register-based VM", false);
   // parse argument
   auto ret = argp.Parse(argc, argv);
 
@@ -170,8 +284,16 @@ int main(int argc, const char *argv[]) {
     return 0;
   }
   else if (!ret) {
-    if (argc == 1 || (argc == 2 && !strcmp(argv[1], "-p"))) {
-      RunREPL(argp.GetValue<bool>("print"));
+    if (IsREPLArgs(argc, argv)) {
+      auto print_value = argp.GetValue<bool>("print");
+      if (argp.GetValue<bool>("vm-repl")) {
+        auto mode = argp.GetValue<bool>("register") ? vm::CodeMode::Register
+                                                     : vm::CodeMode::Stack;
+        RunVMREPL(print_value, mode);
+      }
+      else {
+        RunREPL(print_value, argp.GetValue<bool>("closure-compile"));
+      }
       return 0;
     }
     else {
@@ -184,20 +306,37 @@ int main(int argc, const char *argv[]) {
   // dispatch
   int result;
   auto input = argp.GetValue<string>("input");
+  auto opt_level = argp.GetValue<int>("opt-level");
+  if (opt_level < 0 || opt_level > Optimizer::kMaxOptLevel) {
+    cerr << "invalid optimization level, run '";
+    cerr << argp.program_name() << " -h' for help" << endl;
+    return 1;
+  }
+  auto dump_inline = argp.GetValue<bool>("dump-inline");
+  auto dump_ir = argp.GetValue<bool>("dump-ir");
+  auto mode = argp.GetValue<bool>("register") ? vm::CodeMode::Register
+                                               : vm::CodeMode::Stack;
+  vm::VM::Flavor flavor;
+  if (!GetVMFlavor(argp.GetValue<string>("vm-flavor"), flavor)) {
+    cerr << "invalid VM flavor" << endl;
+    return 1;
+  }
   if (argp.GetValue<bool>("run-vm")) {
-    result = RunBytecode(input);
+    result = RunBytecode(input, flavor);
   }
   else if (argp.GetValue<bool>("compile")) {
-    result = Compile(input, argp.GetValue<string>("output"));
+    result = Compile(input, argp.GetValue<string>("output"), opt_level,
+                     dump_inline, dump_ir, mode);
   }
   else if (argp.GetValue<bool>("compile-run")) {
-    result = CompileAndRun(input);
+    result = CompileAndRun(input, opt_level, dump_inline, dump_ir, mode,
+                           !argp.GetValue<bool>("no-cache"), flavor);
   }
   else if (argp.GetValue<bool>("disassemble")) {
     result = Disassemble(input, argp.GetValue<string>("output"));
   }
   else if (argp.GetValue<bool>("interpret")) {
-    result = Interpret(input);
+    result = Interpret(input, argp.GetValue<bool>("closure-compile"));
   }
   else {
     cerr << "invalid command line argument" << endl;
@@ -0,0 +1,276 @@
+#include "opt/optimizer.h"
+
+#include <limits>
+#include <cstdint>
+
+#include "define/intern.h"
+
+using namespace ionia;
+
+namespace {
+
+enum class Operator {
+  Equal, NotEqual, Less, LessEqual, Great, GreatEqual,
+  Add, Sub, Mul, Div, Mod, And, Or, Not, Xor, Shl, Shr,
+  LogicAnd, LogicOr, LogicNot, Is,
+};
+
+struct OpInfo {
+  Operator op;
+  std::size_t arg_count;
+};
+
+// all builtin operators that can be folded
+const std::map<SymId, OpInfo> kOperators = {
+  {InternId("eq"), {Operator::Equal, 2}},
+  {InternId("neq"), {Operator::NotEqual, 2}},
+  {InternId("lt"), {Operator::Less, 2}},
+  {InternId("le"), {Operator::LessEqual, 2}},
+  {InternId("gt"), {Operator::Great, 2}},
+  {InternId("ge"), {Operator::GreatEqual, 2}},
+  {InternId("+"), {Operator::Add, 2}},
+  {InternId("-"), {Operator::Sub, 2}},
+  {InternId("*"), {Operator::Mul, 2}},
+  {InternId("/"), {Operator::Div, 2}},
+  {InternId("%"), {Operator::Mod, 2}},
+  {InternId("&"), {Operator::And, 2}},
+  {InternId("|"), {Operator::Or, 2}},
+  {InternId("~"), {Operator::Not, 1}},
+  {InternId("^"), {Operator::Xor, 2}},
+  {InternId("<<"), {Operator::Shl, 2}},
+  {InternId(">>"), {Operator::Shr, 2}},
+  {InternId("&&"), {Operator::LogicAnd, 2}},
+  {InternId("||"), {Operator::LogicOr, 2}},
+  {InternId("!"), {Operator::LogicNot, 1}},
+  {InternId("is"), {Operator::Is, 2}},
+};
+
+// other builtin functions
+const SymId kIf = InternId("?");
+const std::set<SymId> kBuiltinFuncs = {
+  InternId("<<<"), InternId(">>>"), kIf,
+};
+
+// calculate the result of operator
+// returns false if the result is undefined or overflowed
+bool CalcOp(Operator op, int l, int r, int &ret) {
+  using Limits = std::numeric_limits<int>;
+  auto check = [&ret](std::int64_t v) {
+    if (v < Limits::min() || v > Limits::max()) return false;
+    ret = static_cast<int>(v);
+    return true;
+  };
+  std::int64_t lhs = l, rhs = r;
+  switch (op) {
+    case Operator::Equal: case Operator::Is: ret = l == r; break;
+    case Operator::NotEqual: ret = l != r; break;
+    case Operator::Less: ret = l < r; break;
+    case Operator::LessEqual: ret = l <= r; break;
+    case Operator::Great: ret = l > r; break;
+    case Operator::GreatEqual: ret = l >= r; break;
+    case Operator::Add: return check(lhs + rhs);
+    case Operator::Sub: return check(lhs - rhs);
+    case Operator::Mul: return check(lhs * rhs);
+    case Operator::Div: return r && check(lhs / rhs);
+    case Operator::Mod: return r && check(lhs % rhs);
+    case Operator::And: ret = l & r; break;
+    case Operator::Or: ret = l | r; break;
+    case Operator::Not: ret = ~l; break;
+    case Operator::Xor: ret = l ^ r; break;
+    case Operator::Shl: {
+      if (l < 0 || r < 0 || r >= 32) return false;
+      return check(lhs << rhs);
+    }
+    case Operator::Shr: {
+      if (r < 0 || r >= 32) return false;
+      ret = l >> r;
+      break;
+    }
+    case Operator::LogicAnd: ret = l && r; break;
+    case Operator::LogicOr: ret = l || r; break;
+    case Operator::LogicNot: ret = !l; break;
+    default: return false;
+  }
+  return true;
+}
+
+// collect all definitions in expression, except ones in functions
+void CollectDefines(const ASTPtr &ast, std::set<SymId> &defs) {
+  if (auto def = dynamic_cast<const DefineAST *>(ast.get())) {
+    defs.insert(def->id());
+    CollectDefines(def->expr(), defs);
+  }
+  else if (auto call = dynamic_cast<const FunCallAST *>(ast.get())) {
+    CollectDefines(call->callee(), defs);
+    for (const auto &i : call->args()) CollectDefines(i, defs);
+  }
+}
+
+// check if expression can be dropped without side effects
+bool IsPure(const ASTPtr &ast) {
+  return dynamic_cast<const FuncAST *>(ast.get()) ||
+         dynamic_cast<const IdAST *>(ast.get()) ||
+         dynamic_cast<const NumAST *>(ast.get());
+}
+
+}  // namespace
+
+void Optimizer::CollectGlobals(const ASTPtr &ast) {
+  if (auto def = dynamic_cast<const DefineAST *>(ast.get())) {
+    ++globals_[def->id()].count;
+    CollectGlobals(def->expr());
+  }
+  else if (auto call = dynamic_cast<const FunCallAST *>(ast.get())) {
+    CollectGlobals(call->callee());
+    for (const auto &i : call->args()) CollectGlobals(i);
+  }
+}
+
+bool Optimizer::IsLocal(SymId id) const {
+  for (const auto &i : scopes_) {
+    if (i.count(id)) return true;
+  }
+  return false;
+}
+
+bool Optimizer::IsBuiltin(SymId id) const {
+  if (!kOperators.count(id) && !kBuiltinFuncs.count(id)) return false;
+  // builtin function can be redefined
+  return !IsLocal(id) && !globals_.count(id);
+}
+
+ASTPtr Optimizer::OptimizeAST(const ASTPtr &ast) {
+  if (auto id = dynamic_cast<const IdAST *>(ast.get())) {
+    return OptimizeId(*id);
+  }
+  else if (auto def = dynamic_cast<const DefineAST *>(ast.get())) {
+    return OptimizeDefine(*def);
+  }
+  else if (auto func = dynamic_cast<const FuncAST *>(ast.get())) {
+    return OptimizeFunc(*func);
+  }
+  else if (auto call = dynamic_cast<const FunCallAST *>(ast.get())) {
+    return OptimizeFunCall(*call);
+  }
+  else {
+    return ast;
+  }
+}
+
+ASTPtr Optimizer::OptimizeId(const IdAST &ast) {
+  // replace global constant with its value
+  if (opt_level_ >= 2 && !IsLocal(ast.id())) {
+    auto it = globals_.find(ast.id());
+    if (it != globals_.end() && it->second.is_const) {
+      return std::make_shared<NumAST>(it->second.value);
+    }
+  }
+  return ast.shared_from_this();
+}
+
+ASTPtr Optimizer::OptimizeDefine(const DefineAST &ast) {
+  auto expr = OptimizeAST(ast.expr());
+  // record global variables that are defined as constant exactly once
+  if (opt_level_ >= 2 && scopes_.empty()) {
+    auto num = dynamic_cast<const NumAST *>(expr.get());
+    if (num && globals_[ast.id()].count == 1) {
+      globals_[ast.id()].value = num->num();
+      new_consts_.push_back(ast.id());
+    }
+  }
+  // share the original node if nothing changed
+  if (expr == ast.expr()) return ast.shared_from_this();
+  return std::make_shared<DefineAST>(ast.id(), std::move(expr));
+}
+
+ASTPtr Optimizer::OptimizeFunc(const FuncAST &ast) {
+  // enter a new scope
+  std::set<SymId> scope(ast.args().begin(), ast.args().end());
+  CollectDefines(ast.expr(), scope);
+  scopes_.push_back(std::move(scope));
+  // optimize function body
+  auto expr = OptimizeAST(ast.expr());
+  scopes_.pop_back();
+  if (expr == ast.expr()) return ast.shared_from_this();
+  return std::make_shared<FuncAST>(ast.args(), std::move(expr));
+}
+
+ASTPtr Optimizer::OptimizeFunCall(const FunCallAST &ast) {
+  auto callee = OptimizeAST(ast.callee());
+  ASTPtrList args;
+  for (const auto &i : ast.args()) args.push_back(OptimizeAST(i));
+  // try to fold builtin function call
+  if (auto id = dynamic_cast<const IdAST *>(callee.get())) {
+    if (IsBuiltin(id->id())) {
+      if (auto ret = FoldBuiltinCall(id->id(), args)) return ret;
+    }
+  }
+  if (callee == ast.callee() && args == ast.args()) {
+    return ast.shared_from_this();
+  }
+  return std::make_shared<FunCallAST>(std::move(callee), std::move(args));
+}
+
+ASTPtr Optimizer::FoldBuiltinCall(SymId id, ASTPtrList &args) {
+  if (id == kIf) {
+    // check if condition is a constant
+    if (args.size() != 3) return nullptr;
+    auto cond = dynamic_cast<const NumAST *>(args[0].get());
+    if (!cond) return nullptr;
+    // check if dead branch can be removed
+    auto &live = cond->num() ? args[1] : args[2];
+    if (!IsPure(cond->num() ? args[2] : args[1])) return nullptr;
+    // expand body of live branch if it does not define anything
+    if (auto func = dynamic_cast<const FuncAST *>(live.get())) {
+      std::set<SymId> defs;
+      CollectDefines(func->expr(), defs);
+      if (func->args().empty() && defs.empty()) {
+        return func->expr();
+      }
+    }
+    return std::make_shared<FunCallAST>(std::move(live), ASTPtrList());
+  }
+  else if (auto it = kOperators.find(id); it != kOperators.end()) {
+    // check arguments
+    const auto &info = it->second;
+    if (args.size() != info.arg_count) return nullptr;
+    int vals[2] = {0, 0};
+    for (std::size_t i = 0; i < args.size(); ++i) {
+      auto num = dynamic_cast<const NumAST *>(args[i].get());
+      if (!num) return nullptr;
+      vals[i] = num->num();
+    }
+    // calculate the result
+    int ret;
+    if (!CalcOp(info.op, vals[0], vals[1], ret)) return nullptr;
+    return std::make_shared<NumAST>(ret);
+  }
+  return nullptr;
+}
+
+ASTPtrList Optimizer::Optimize() {
+  ASTPtrList program;
+  if (!opt_level_) {
+    program = std::move(program_);
+    Reset();
+    return program;
+  }
+  // collect global variables
+  for (const auto &i : program_) CollectGlobals(i);
+  // optimize statements
+  for (const auto &i : program_) {
+    program.push_back(OptimizeAST(i));
+    // constants are visible since the next statement
+    for (const auto &id : new_consts_) globals_[id].is_const = true;
+    new_consts_.clear();
+  }
+  Reset();
+  return program;
+}
+
+void Optimizer::Reset() {
+  program_.clear();
+  globals_.clear();
+  new_consts_.clear();
+  scopes_.clear();
+}
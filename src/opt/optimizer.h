@@ -0,0 +1,73 @@
+#ifndef IONIA_OPT_OPTIMIZER_H_
+#define IONIA_OPT_OPTIMIZER_H_
+
+#include <vector>
+#include <set>
+#include <map>
+#include <cstddef>
+
+#include "define/ast.h"
+
+namespace ionia {
+
+// AST level optimizer, runs between parser and compiler
+// level 0: do nothing
+// level 1: fold builtin operators on literals, remove dead branches
+// level 2: also propagate immutable global constants
+class Optimizer {
+ public:
+  // maximum supported optimization level
+  static constexpr int kMaxOptLevel = 2;
+
+  Optimizer() : opt_level_(0) {}
+
+  // add next statement of program
+  void AddNext(const ASTPtr &ast) { program_.push_back(ast); }
+  // optimize all statements, returns the optimized program
+  ASTPtrList Optimize();
+  // reset optimizer
+  void Reset();
+
+  // setters
+  void set_opt_level(int opt_level) { opt_level_ = opt_level; }
+
+  // getters
+  int opt_level() const { return opt_level_; }
+
+ private:
+  struct GlobalInfo {
+    // times of definition
+    int count;
+    // value if global variable is a constant
+    bool is_const;
+    int value;
+  };
+
+  // collect all definitions of global variables
+  void CollectGlobals(const ASTPtr &ast);
+  // check if identifier is bound in function scopes
+  bool IsLocal(SymId id) const;
+  // check if identifier refers to builtin function
+  bool IsBuiltin(SymId id) const;
+
+  ASTPtr OptimizeAST(const ASTPtr &ast);
+  ASTPtr OptimizeId(const IdAST &ast);
+  ASTPtr OptimizeDefine(const DefineAST &ast);
+  ASTPtr OptimizeFunc(const FuncAST &ast);
+  ASTPtr OptimizeFunCall(const FunCallAST &ast);
+  // try to fold builtin function call, returns 'nullptr' if failed
+  ASTPtr FoldBuiltinCall(SymId id, ASTPtrList &args);
+
+  int opt_level_;
+  ASTPtrList program_;
+  // global variables
+  std::map<SymId, GlobalInfo> globals_;
+  // constants defined by current statement, visible since next one
+  std::vector<SymId> new_consts_;
+  // names bound in each enclosing function
+  std::vector<std::set<SymId>> scopes_;
+};
+
+}  // namespace ionia
+
+#endif  // IONIA_OPT_OPTIMIZER_H_
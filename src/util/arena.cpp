@@ -0,0 +1,28 @@
+#include "util/arena.h"
+
+#include <cstdint>
+
+using namespace ionia::util;
+
+void *Arena::Allocate(std::size_t size, std::size_t align) {
+  // get padding of current position
+  auto addr = reinterpret_cast<std::uintptr_t>(cur_);
+  auto pad = (align - addr % align) % align;
+  if (!cur_ || pad + size > left_) {
+    // large objects are stored in their own blocks
+    auto block_size = size + align > kBlockSize ? size + align : kBlockSize;
+    blocks_.emplace_back(new char[block_size]);
+    cur_ = blocks_.back().get();
+    left_ = block_size;
+    addr = reinterpret_cast<std::uintptr_t>(cur_);
+    pad = (align - addr % align) % align;
+  }
+  auto ptr = cur_ + pad;
+  cur_ += pad + size;
+  left_ -= pad + size;
+  return ptr;
+}
+
+void Arena::Release() {
+  if (!--ref_count_) delete this;
+}
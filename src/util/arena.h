@@ -0,0 +1,105 @@
+#ifndef IONIA_UTIL_ARENA_H_
+#define IONIA_UTIL_ARENA_H_
+
+#include <memory>
+#include <new>
+#include <vector>
+#include <cstddef>
+
+namespace ionia::util {
+
+// bump allocator, all memory is freed at once when arena is destructed
+class Arena {
+ public:
+  Arena() : cur_(nullptr), left_(0), ref_count_(0) {}
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // allocate memory with specific size and alignment
+  void *Allocate(std::size_t size, std::size_t align);
+
+  // increase reference count
+  void Retain() { ++ref_count_; }
+  // decrease reference count, and free arena if it's no longer used
+  void Release();
+
+ private:
+  // size of each memory block
+  static constexpr std::size_t kBlockSize = 64 * 1024;
+
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  // current position and size left in the last block
+  char *cur_;
+  std::size_t left_;
+  // number of allocators that refer to this arena
+  std::size_t ref_count_;
+};
+
+// STL compatible allocator that allocates from an arena
+// deallocation does nothing, every allocator holds a reference of
+// the arena, so arena will be freed after the last object that
+// allocated from it is destructed, default constructed allocator
+// allocates from heap
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+
+  ArenaAllocator() : arena_(nullptr) {}
+  ArenaAllocator(const ArenaAllocator &other) : arena_(other.arena_) {
+    Acquire();
+  }
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.arena()) {
+    Acquire();
+  }
+  ~ArenaAllocator() { Release(); }
+
+  // create an allocator that allocates from a new arena
+  static ArenaAllocator NewArena() { return ArenaAllocator(new Arena); }
+
+  ArenaAllocator &operator=(const ArenaAllocator &other) {
+    if (arena_ != other.arena_) {
+      Release();
+      arena_ = other.arena_;
+      Acquire();
+    }
+    return *this;
+  }
+
+  T *allocate(std::size_t n) {
+    if (!arena_) return static_cast<T *>(::operator new(n * sizeof(T)));
+    return static_cast<T *>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *p, std::size_t) {
+    if (!arena_) ::operator delete(p);
+  }
+
+  Arena *arena() const { return arena_; }
+
+ private:
+  explicit ArenaAllocator(Arena *arena) : arena_(arena) { Acquire(); }
+
+  void Acquire() {
+    if (arena_) arena_->Retain();
+  }
+  void Release() {
+    if (arena_) arena_->Release();
+  }
+
+  Arena *arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &l, const ArenaAllocator<U> &r) {
+  return l.arena() == r.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &l, const ArenaAllocator<U> &r) {
+  return !(l == r);
+}
+
+}  // namespace ionia::util
+
+#endif  // IONIA_UTIL_ARENA_H_
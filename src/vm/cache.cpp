@@ -0,0 +1,239 @@
+#include "vm/cache.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <filesystem>
+#include <system_error>
+#include <random>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "version.h"
+#include "vm/codegen.h"
+
+using namespace ionia::vm;
+namespace fs = std::filesystem;
+
+namespace {
+
+// extension of cache entries & temporary files
+constexpr const char *kEntryExt = ".ibc";
+constexpr const char *kTempExt = ".tmp";
+
+// 64-bit FNV-1a hash
+class Hasher {
+ public:
+  Hasher() : hash_(0xcbf29ce484222325) {}
+
+  void Update(const void *data, std::size_t size) {
+    auto ptr = static_cast<const std::uint8_t *>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+      hash_ = (hash_ ^ ptr[i]) * 0x100000001b3;
+    }
+  }
+
+  std::uint64_t hash() const { return hash_; }
+
+ private:
+  std::uint64_t hash_;
+};
+
+// 64-bit hash that mixes 8 bytes at a time,
+// finalized by the mixer of SplitMix64
+class MixHasher {
+ public:
+  MixHasher() : hash_(0x9e3779b97f4a7c15) {}
+
+  void Update(const void *data, std::size_t size) {
+    auto ptr = static_cast<const std::uint8_t *>(data);
+    for (std::size_t i = 0; i < size; i += 8) {
+      std::uint64_t word = 0;
+      std::memcpy(&word, ptr + i, std::min<std::size_t>(size - i, 8));
+      hash_ = Mix(hash_ ^ word);
+    }
+  }
+
+  std::uint64_t hash() const { return Mix(hash_); }
+
+ private:
+  static std::uint64_t Mix(std::uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+  }
+
+  std::uint64_t hash_;
+};
+
+// header of cache entry, length and hashes of key
+struct EntryHeader {
+  std::uint64_t len, hash, mix_hash;
+};
+
+EntryHeader GetHeader(const std::string &key) {
+  Hasher hasher;
+  hasher.Update(key.data(), key.size());
+  MixHasher mix_hasher;
+  mix_hasher.Update(key.data(), key.size());
+  return {key.size(), hasher.hash(), mix_hasher.hash()};
+}
+
+}  // namespace
+
+// definitions of static member variables
+constexpr std::uintmax_t CompileCache::kDefaultMaxSize;
+constexpr int CompileCache::kTempFileExpire;
+
+std::string CompileCache::GetDefaultDir() {
+  if (auto dir = std::getenv("IONIA_CACHE_DIR")) return dir;
+  if (auto dir = std::getenv("XDG_CACHE_HOME")) {
+    return (fs::path(dir) / "ionia").string();
+  }
+  if (auto dir = std::getenv("HOME")) {
+    return (fs::path(dir) / ".cache" / "ionia").string();
+  }
+  return "";
+}
+
+std::uintmax_t CompileCache::GetDefaultMaxSize() {
+  if (auto size = std::getenv("IONIA_CACHE_SIZE")) {
+    return std::strtoull(size, nullptr, 10);
+  }
+  return kDefaultMaxSize;
+}
+
+std::string CompileCache::GetKey(const std::string &source, int opt_level,
+                                 CodeMode mode) {
+  // compiler version, options and source code
+  std::string key = APP_VERSION;
+  key.push_back('\0');
+  std::uint32_t opts[] = {static_cast<std::uint32_t>(opt_level),
+                          static_cast<std::uint32_t>(mode)};
+  key.append(reinterpret_cast<const char *>(opts), sizeof(opts));
+  key.append(source);
+  return key;
+}
+
+bool CompileCache::Load(const std::string &key, Program &program) {
+  auto path = GetPath(key);
+  // read cache entry
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs.is_open()) return false;
+  std::vector<std::uint8_t> buffer(std::istreambuf_iterator<char>(ifs),
+                                   {});
+  ifs.close();
+  // check if entry is stored by the same key, since different keys
+  // may have the same path, then parse bytecode after the header
+  EntryHeader header;
+  auto is_valid = buffer.size() >= sizeof(header);
+  if (is_valid) {
+    std::memcpy(&header, buffer.data(), sizeof(header));
+    auto expected = GetHeader(key);
+    is_valid = header.len == expected.len &&
+               header.hash == expected.hash &&
+               header.mix_hash == expected.mix_hash;
+    auto begin = buffer.begin();
+    if (is_valid) buffer.erase(begin, begin + sizeof(header));
+  }
+  if (!is_valid || !CodeGen::ParseBytecode(buffer, program)) {
+    // remove corrupt entry, or entry of another key
+    Remove(key);
+    return false;
+  }
+  // mark as recently used, entry may be evicted by other processes
+  std::error_code ec;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+  return true;
+}
+
+bool CompileCache::Store(const std::string &key, const Program &program) {
+  std::error_code ec;
+  fs::create_directories(dir_, ec);
+  if (ec) return false;
+  // write to temporary file
+  auto path = GetPath(key);
+  std::random_device rd;
+  std::ostringstream oss;
+  oss << path << '.' << std::hex << rd() << rd() << kTempExt;
+  auto temp = oss.str();
+  auto content = CodeGen::SerializeProgram(program);
+  {
+    // entry starts with header of its key
+    std::ofstream ofs(temp, std::ios::binary);
+    auto header = GetHeader(key);
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char *>(content.data()),
+              content.size());
+    if (!ofs) {
+      ofs.close();
+      fs::remove(temp, ec);
+      return false;
+    }
+  }
+  // rename atomically, readers always get a complete entry
+  fs::rename(temp, path, ec);
+  if (ec) {
+    fs::remove(temp, ec);
+    return false;
+  }
+  Evict(path);
+  return true;
+}
+
+void CompileCache::Remove(const std::string &key) {
+  std::error_code ec;
+  fs::remove(GetPath(key), ec);
+}
+
+std::string CompileCache::GetPath(const std::string &key) const {
+  // entries are named by hash and length of key
+  Hasher hasher;
+  hasher.Update(key.data(), key.size());
+  std::ostringstream oss;
+  oss << std::hex << std::setfill('0') << std::setw(16) << hasher.hash()
+      << '-' << std::dec << key.size() << kEntryExt;
+  return (fs::path(dir_) / oss.str()).string();
+}
+
+void CompileCache::Evict(const std::string &keep) {
+  using Entry = std::tuple<fs::file_time_type, std::uintmax_t, fs::path>;
+  std::vector<Entry> entries;
+  std::uintmax_t total = 0;
+  auto expire = fs::file_time_type::clock::now() -
+                std::chrono::seconds(kTempFileExpire);
+  // collect all entries, errors are ignored since other processes
+  // may be modifying the cache at the same time
+  std::error_code ec, iter_ec;
+  for (fs::directory_iterator it(dir_, iter_ec), end; !iter_ec && it != end;
+       it.increment(iter_ec)) {
+    if (!it->is_regular_file(ec)) continue;
+    auto time = it->last_write_time(ec);
+    if (ec) continue;
+    const auto &path = it->path();
+    if (path.extension() == kEntryExt) {
+      auto size = it->file_size(ec);
+      if (ec) continue;
+      // newly stored entry is counted but never removed
+      if (path != keep) entries.push_back({time, size, path});
+      total += size;
+    }
+    else if (path.extension() == kTempExt && time < expire) {
+      // remove temporary file left by crashed process
+      fs::remove(path, ec);
+    }
+  }
+  if (total <= max_size_) return;
+  // remove least recently used entries
+  std::sort(entries.begin(), entries.end());
+  for (const auto &i : entries) {
+    if (total <= max_size_) break;
+    fs::remove(std::get<2>(i), ec);
+    total -= std::get<1>(i);
+  }
+}
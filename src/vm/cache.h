@@ -0,0 +1,61 @@
+#ifndef IONIA_VM_CACHE_H_
+#define IONIA_VM_CACHE_H_
+
+#include <string>
+#include <cstdint>
+
+#include "vm/define.h"
+
+namespace ionia::vm {
+
+// persistent on-disk cache of compiled programs
+// entries are bytecode files named by hash of their keys (source code,
+// compiler version and compile options), each entry also stores length
+// and two independent hashes of its key, so entries of colliding paths
+// are never mixed up, entries are written to temporary files and renamed
+// atomically, so cache can be shared between processes
+class CompileCache {
+ public:
+  CompileCache(const std::string &dir)
+      : dir_(dir), max_size_(GetDefaultMaxSize()) {}
+
+  // get default cache directory, returns empty string if not available
+  static std::string GetDefaultDir();
+  // get default maximum total size of cache in bytes
+  static std::uintmax_t GetDefaultMaxSize();
+  // get key of source code that compiled with specific options
+  static std::string GetKey(const std::string &source, int opt_level,
+                            CodeMode mode);
+
+  // load cached program, returns false if not found or invalid,
+  // invalid entries are removed
+  bool Load(const std::string &key, Program &program);
+  // store program to cache, evict least recently used entries
+  // if total size exceeds the limit, returns false if failed
+  bool Store(const std::string &key, const Program &program);
+  // remove entry from cache
+  void Remove(const std::string &key);
+
+  // setters
+  // set maximum total size of cache in bytes
+  void set_max_size(std::uintmax_t max_size) { max_size_ = max_size; }
+
+ private:
+  // default maximum total size of cache (64 MiB)
+  static constexpr std::uintmax_t kDefaultMaxSize = 64 << 20;
+  // temporary files older than this are treated as leftovers (seconds)
+  static constexpr int kTempFileExpire = 600;
+
+  // get path of cache entry
+  std::string GetPath(const std::string &key) const;
+  // remove least recently used entries until size is under the limit,
+  // entry of the specific path is always kept
+  void Evict(const std::string &keep);
+
+  std::string dir_;
+  std::uintmax_t max_size_;
+};
+
+}  // namespace ionia::vm
+
+#endif  // IONIA_VM_CACHE_H_
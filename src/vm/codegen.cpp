@@ -1,11 +1,13 @@
 #include "vm/codegen.h"
 
 #include <fstream>
-#include <sstream>
+#include <utility>
+#include <algorithm>
 #include <cstddef>
 #include <cassert>
 
 #include "version.h"
+#include "vm/peephole.h"
 #include "util/cast.h"
 
 using namespace ionia::vm;
@@ -13,34 +15,57 @@ using namespace ionia::util;
 
 // definitions of static member variables
 const std::uint32_t CodeGen::kFileHeader;
+const std::uint32_t CodeGen::kMinVersionInfo;
 const std::uint32_t CodeGen::kMinFileSize;
+const std::uint32_t CodeGen::kFITItemSize;
 const std::uint32_t CodeGen::kGFTItemSize;
 
-int CodeGen::ParseBytecode(const std::vector<std::uint8_t> &buffer,
-                           SymbolTable &sym_table, FuncPCTable &pc_table,
-                           GlobalFuncTable &global_funcs) {
+bool CodeGen::ParseBytecode(const std::vector<std::uint8_t> &buffer,
+                            Program &program) {
+  auto &sym_table = program.sym_table;
+  auto &pc_table = program.pc_table;
+  auto &func_infos = program.func_infos;
+  auto &global_funcs = program.global_funcs;
   std::size_t pos = 0;
+  // check if there are at least 'size' bytes after current position
+  auto has_bytes = [&buffer, &pos](std::size_t size) {
+    return size <= buffer.size() - pos;
+  };
   // check buffer size
-  if (buffer.size() < kMinFileSize) return -1;
+  if (buffer.size() < kMinFileSize) return false;
   // check file header
   auto magic_num = IntPtrCast<32>(buffer.data() + pos);
-  if (*magic_num != kFileHeader) return -1;
+  if (*magic_num != kFileHeader) return false;
   pos += 4;
   // check version info
   auto ver_info = IntPtrCast<32>(buffer.data() + pos);
   int major = (*ver_info >> 20) & 0xfff, minor = (*ver_info >> 12) & 0xff,
       patch = *ver_info & 0xfff;
-  if (CompareVersion(major, minor, patch) > 0) return -1;
+  if (CompareVersion(major, minor, patch) > 0) return false;
+  if (*ver_info < kMinVersionInfo) return false;
+  pos += 4;
+  // read bytecode mode
+  auto mode_info = *IntPtrCast<32>(buffer.data() + pos);
+  if (mode_info > static_cast<std::uint32_t>(CodeMode::Register)) {
+    return false;
+  }
+  program.mode = static_cast<CodeMode>(mode_info);
+  pos += 4;
+  // read slot count of top level frame
+  program.main_slots = *IntPtrCast<32>(buffer.data() + pos);
   pos += 4;
   // read symbol table length
   auto sym_len = IntPtrCast<32>(buffer.data() + pos);
   pos += 4;
+  if (!has_bytes(*sym_len)) return false;
   // read symbol table
   std::string symbol;
   sym_table.clear();
   for (std::size_t i = 0; i < *sym_len; ++i) {
     if (buffer[pos + i] == '\0') {
-      sym_table.push_back(symbol);
+      // symbols must be unique
+      auto index = sym_table.size();
+      if (sym_table.Intern(symbol) != index) return false;
       symbol.clear();
     }
     else {
@@ -49,8 +74,10 @@ int CodeGen::ParseBytecode(const std::vector<std::uint8_t> &buffer,
   }
   pos += *sym_len;
   // read function pc table length
+  if (!has_bytes(4)) return false;
   auto fpt_len = IntPtrCast<32>(buffer.data() + pos);
   pos += 4;
+  if (*fpt_len % 4 || !has_bytes(*fpt_len)) return false;
   // read function pc table
   pc_table.clear();
   for (std::size_t i = 0; i < *fpt_len; i += 4) {
@@ -58,41 +85,116 @@ int CodeGen::ParseBytecode(const std::vector<std::uint8_t> &buffer,
     pc_table.push_back(*func_pc);
   }
   pos += *fpt_len;
+  // read function info table length
+  if (!has_bytes(4)) return false;
+  auto fit_len = IntPtrCast<32>(buffer.data() + pos);
+  if (*fit_len % kFITItemSize ||
+      *fit_len / kFITItemSize != pc_table.size()) {
+    return false;
+  }
+  pos += 4;
+  if (!has_bytes(*fit_len)) return false;
+  // read function info table
+  FuncInfo func_info;
+  func_infos.clear();
+  for (std::size_t i = 0; i < *fit_len; i += kFITItemSize) {
+    func_info.slot_count = *IntPtrCast<32>(buffer.data() + pos + i);
+    func_info.arg_count = *IntPtrCast<32>(buffer.data() + pos + i + 4);
+    if (func_info.arg_count > func_info.slot_count) return false;
+    func_infos.push_back(func_info);
+  }
+  pos += *fit_len;
   // read global function table length
+  if (!has_bytes(4)) return false;
   auto global_len = IntPtrCast<32>(buffer.data() + pos);
   pos += 4;
+  if (*global_len % kGFTItemSize || !has_bytes(*global_len)) return false;
   // read global function table
   GlobalFunc glob_func;
   global_funcs.clear();
   for (std::size_t i = 0; i < *global_len;) {
     // read function id
     auto func_id = IntPtrCast<32>(buffer.data() + pos + i);
-    if (*func_id >= *sym_len) return -1;
+    if (*func_id >= sym_table.size()) return false;
     i += 4;
     // read function pc
     glob_func.pc_id = *IntPtrCast<32>(buffer.data() + pos + i);
-    if (glob_func.pc_id >= *fpt_len) return -1;
+    if (glob_func.pc_id >= pc_table.size()) return false;
     i += 4;
     // read argument count
-    glob_func.arg_count = buffer[pos + i];
-    i += 1;
+    glob_func.arg_count = *IntPtrCast<32>(buffer.data() + pos + i);
+    i += 4;
     // insert to table
     global_funcs.insert({sym_table[*func_id], glob_func});
   }
   pos += *global_len;
-  // return position
-  return static_cast<int>(pos);
+  // copy bytecode segment
+  program.insts.assign(buffer.begin() + pos, buffer.end());
+  return true;
 }
 
-// TODO: optimize
-std::uint32_t CodeGen::GetSymbolIndex(const std::string &name) {
-  // search name in symbol table
-  for (std::size_t i = 0; i < sym_table_.size(); ++i) {
-    if (sym_table_[i] == name) return i;
+std::vector<std::uint8_t> CodeGen::SerializeProgram(const Program &program) {
+  std::vector<std::uint8_t> buffer;
+  auto push_bytes = [&buffer](const void *data, std::size_t size) {
+    auto ptr = PtrCast<std::uint8_t>(data);
+    buffer.insert(buffer.end(), ptr, ptr + size);
+  };
+  auto push_word = [&push_bytes](std::uint32_t word) {
+    push_bytes(&word, sizeof(word));
+  };
+  // generate file header
+  push_word(kFileHeader);
+  // generate version info
+  push_word(((APP_VERSION_MAJOR & 0xfff) << 20) |
+            ((APP_VERSION_MINOR & 0xff) << 12) |
+            (APP_VERSION_PATCH & 0xfff));
+  // generate bytecode mode & slot count of top level frame
+  push_word(static_cast<std::uint32_t>(program.mode));
+  push_word(program.main_slots);
+  // generate symbol table
+  const auto &sym_table = program.sym_table;
+  std::uint32_t sym_len = 0;
+  for (std::uint32_t i = 0; i < sym_table.size(); ++i) {
+    sym_len += sym_table[i].size() + 1;
+  }
+  push_word(sym_len);
+  for (std::uint32_t i = 0; i < sym_table.size(); ++i) {
+    const auto &sym = sym_table[i];
+    push_bytes(sym.c_str(), sym.size() + 1);
   }
-  // symbol not found, create new
-  sym_table_.push_back(name);
-  return sym_table_.size() - 1;
+  // generate function pc table
+  push_word(program.pc_table.size() * sizeof(std::uint32_t));
+  for (const auto &i : program.pc_table) push_word(i);
+  // generate function info table
+  assert(program.func_infos.size() == program.pc_table.size());
+  push_word(program.func_infos.size() * kFITItemSize);
+  for (const auto &i : program.func_infos) {
+    push_word(i.slot_count);
+    push_word(i.arg_count);
+  }
+  // generate global function table, sorted by symbol index of name
+  std::vector<std::pair<std::uint32_t, const GlobalFunc *>> funcs;
+  for (const auto &it : program.global_funcs) {
+    // functions whose names are not in symbol table can not be
+    // referenced by bytecode file, just skip them
+    std::uint32_t index = 0;
+    if (!sym_table.Find(it.first, index)) continue;
+    funcs.push_back({index, &it.second});
+  }
+  std::sort(funcs.begin(), funcs.end());
+  push_word(funcs.size() * kGFTItemSize);
+  for (const auto &it : funcs) {
+    push_word(it.first);
+    push_word(it.second->pc_id);
+    push_word(it.second->arg_count);
+  }
+  // write instructions
+  buffer.insert(buffer.end(), program.insts.begin(), program.insts.end());
+  return buffer;
+}
+
+std::uint32_t CodeGen::GetSymbolIndex(const std::string &name) {
+  return sym_table_.Intern(name);
 }
 
 void CodeGen::PushInst(OpCode op, std::uint32_t opr) {
@@ -102,12 +204,24 @@ void CodeGen::PushInst(OpCode op, std::uint32_t opr) {
   inst_buf_.push_back(ptr[1]);
   inst_buf_.push_back(ptr[2]);
   inst_buf_.push_back(ptr[3]);
-  last_op_ = static_cast<OpCode>(inst.opcode);
 }
 
 void CodeGen::PushInst(OpCode op) {
   inst_buf_.push_back(*IntPtrCast<8>(&op));
-  last_op_ = op;
+}
+
+void CodeGen::PushRegInst(RegOpCode op, std::uint8_t a, std::uint8_t b,
+                          std::uint8_t c) {
+  assert(mode_ == CodeMode::Register);
+  inst_buf_.push_back(static_cast<std::uint8_t>(op));
+  inst_buf_.push_back(a);
+  inst_buf_.push_back(b);
+  inst_buf_.push_back(c);
+}
+
+void CodeGen::PushWord(std::uint32_t word) {
+  auto ptr = IntPtrCast<8>(&word);
+  inst_buf_.insert(inst_buf_.end(), ptr, ptr + 4);
 }
 
 std::uint32_t CodeGen::GetFuncId(const std::string &label) {
@@ -128,58 +242,23 @@ std::uint32_t CodeGen::GetFuncId(const std::string &label) {
   }
 }
 
-std::vector<std::uint8_t> CodeGen::GenerateBytecode() {
-  std::ostringstream content;
+Program CodeGen::GenerateProgram() {
   assert(unfilled_.empty());
-  // generate file header
-  content.write(PtrCast<char>(&kFileHeader), sizeof(kFileHeader));
-  // generate version info
-  std::uint32_t ver_info = ((APP_VERSION_MAJOR & 0xfff) << 20) |
-                           ((APP_VERSION_MINOR & 0xff) << 12) |
-                           (APP_VERSION_PATCH & 0xfff);
-  content.write(PtrCast<char>(&ver_info), sizeof(ver_info));
-  // generate symbol table
-  std::uint32_t sym_len = 0;
-  auto len_pos = content.tellp();
-  content.write(PtrCast<char>(&sym_len), sizeof(sym_len));
-  for (const auto &i : sym_table_) {
-    content.write(i.c_str(), i.size() + 1);
-    sym_len += i.size() + 1;
-  }
-  // update symbol table length
-  content.seekp(len_pos);
-  content.write(PtrCast<char>(&sym_len), sizeof(sym_len));
-  content.seekp(0, std::ios::end);
-  // generate function pc table
-  std::uint32_t fpt_len = pc_table_.size() * sizeof(std::uint32_t);
-  content.write(PtrCast<char>(&fpt_len), sizeof(fpt_len));
-  for (const auto &i : pc_table_) {
-    content.write(PtrCast<char>(&i), sizeof(i));
-  }
-  // generate global function table
-  std::uint32_t gft_len = global_funcs_.size() * kGFTItemSize;
-  content.write(PtrCast<char>(&gft_len), sizeof(gft_len));
+  // run peephole optimization on stack-based instructions
+  if (mode_ == CodeMode::Stack) OptimizeStackInsts(inst_buf_, pc_table_, 0);
+  // move tables & instructions to program
+  Program program = {mode_, main_slots_, std::move(sym_table_),
+                     std::move(pc_table_), std::move(func_infos_), {},
+                     std::move(inst_buf_)};
   for (const auto &it : global_funcs_) {
-    const auto &func = it.second;
-    // write function id
-    content.write(PtrCast<char>(&it.first), sizeof(it.first));
-    gft_len += sizeof(it.first);
-    // write function pc
-    content.write(PtrCast<char>(&func.pc_id), sizeof(func.pc_id));
-    gft_len += sizeof(func.pc_id);
-    // write argument count
-    content.write(PtrCast<char>(&func.arg_count), sizeof(func.arg_count));
-    gft_len += sizeof(func.arg_count);
+    program.global_funcs.insert({program.sym_table[it.first], it.second});
   }
-  // write instructions
-  content.write(PtrCast<char>(inst_buf_.data()), inst_buf_.size());
-  // generate byte array
-  auto s = content.str();
-  return std::vector<std::uint8_t>(s.begin(), s.end());
+  Reset();
+  return program;
 }
 
 void CodeGen::GenerateBytecodeFile(const std::string &file) {
-  auto content = GenerateBytecode();
+  auto content = SerializeProgram(GenerateProgram());
   std::ofstream ofs(file, std::ios::binary);
   ofs.write(reinterpret_cast<char *>(content.data()), content.size());
 }
@@ -187,11 +266,46 @@ void CodeGen::GenerateBytecodeFile(const std::string &file) {
 void CodeGen::Reset() {
   sym_table_.clear();
   pc_table_.clear();
+  func_infos_.clear();
   global_funcs_.clear();
   inst_buf_.clear();
   labels_.clear();
   unfilled_.clear();
-  last_op_ = static_cast<OpCode>(0);
+  main_slots_ = 0;
+}
+
+std::size_t CodeGen::BeginSegment() {
+  assert(unfilled_.empty());
+  seg_func_count_ = pc_table_.size();
+  seg_global_funcs_ = global_funcs_;
+  return inst_buf_.size();
+}
+
+void CodeGen::FinishSegment(std::size_t begin) {
+  assert(unfilled_.empty());
+  // run peephole optimization on stack-based instructions of segment
+  if (mode_ == CodeMode::Stack) {
+    OptimizeStackInsts(inst_buf_, pc_table_, begin);
+  }
+}
+
+void CodeGen::DiscardSegment(std::size_t begin) {
+  inst_buf_.resize(begin);
+  // functions of segment are always placed after previous ones
+  pc_table_.resize(seg_func_count_);
+  if (func_infos_.size() > seg_func_count_) {
+    func_infos_.resize(seg_func_count_);
+  }
+  for (auto it = labels_.begin(); it != labels_.end();) {
+    if (it->second >= seg_func_count_) {
+      it = labels_.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+  unfilled_.clear();
+  global_funcs_ = std::move(seg_global_funcs_);
 }
 
 void CodeGen::GET(const std::string &name) {
@@ -202,8 +316,8 @@ void CodeGen::SET(const std::string &name) {
   PushInst(OpCode::SET, GetSymbolIndex(name));
 }
 
-void CodeGen::FUN() {
-  PushInst(OpCode::FUN);
+void CodeGen::FUN(std::uint32_t capture_count) {
+  PushInst(OpCode::FUN, capture_count);
 }
 
 void CodeGen::CNST(std::uint32_t num) {
@@ -226,12 +340,116 @@ void CodeGen::RET() {
   PushInst(OpCode::RET);
 }
 
-void CodeGen::CALL() {
-  PushInst(OpCode::CALL);
+void CodeGen::CALL(std::uint32_t arg_count) {
+  PushInst(OpCode::CALL, arg_count);
+}
+
+void CodeGen::TCAL(std::uint32_t arg_count) {
+  PushInst(OpCode::TCAL, arg_count);
 }
 
-void CodeGen::TCAL() {
-  PushInst(OpCode::TCAL);
+void CodeGen::GETL(std::uint32_t index) {
+  PushInst(OpCode::GETL, index);
+}
+
+void CodeGen::SETL(std::uint32_t index) {
+  PushInst(OpCode::SETL, index);
+}
+
+void CodeGen::GETC(std::uint32_t index) {
+  PushInst(OpCode::GETC, index);
+}
+
+void CodeGen::BOX(std::uint32_t index) {
+  PushInst(OpCode::BOX, index);
+}
+
+void CodeGen::UNBX() {
+  PushInst(OpCode::UNBX);
+}
+
+void CodeGen::SETB(std::uint32_t index) {
+  PushInst(OpCode::SETB, index);
+}
+
+void CodeGen::DCAL(const std::string &label) {
+  PushInst(OpCode::DCAL, GetFuncId(label));
+}
+
+void CodeGen::DTCL(const std::string &label) {
+  PushInst(OpCode::DTCL, GetFuncId(label));
+}
+
+void CodeGen::MOV(std::uint8_t dest, std::uint8_t src) {
+  PushRegInst(RegOpCode::MOV, dest, src, 0);
+}
+
+void CodeGen::LDI(std::uint8_t dest, std::int16_t num) {
+  auto imm = static_cast<std::uint16_t>(num);
+  PushRegInst(RegOpCode::LDI, dest, imm & 0xff, imm >> 8);
+}
+
+void CodeGen::LDK(std::uint8_t dest, std::int32_t num) {
+  PushRegInst(RegOpCode::LDK, dest, 0, 0);
+  PushWord(num);
+}
+
+void CodeGen::LDG(std::uint8_t dest, const std::string &name) {
+  PushRegInst(RegOpCode::LDG, dest, 0, 0);
+  PushWord(GetSymbolIndex(name));
+}
+
+void CodeGen::STG(std::uint8_t src, const std::string &name) {
+  PushRegInst(RegOpCode::STG, src, 0, 0);
+  PushWord(GetSymbolIndex(name));
+}
+
+void CodeGen::LDC(std::uint8_t dest, std::uint16_t index) {
+  PushRegInst(RegOpCode::LDC, dest, index & 0xff, index >> 8);
+}
+
+void CodeGen::MKB(std::uint8_t reg) {
+  PushRegInst(RegOpCode::MKB, reg, 0, 0);
+}
+
+void CodeGen::LDB(std::uint8_t dest, std::uint8_t box) {
+  PushRegInst(RegOpCode::LDB, dest, box, 0);
+}
+
+void CodeGen::STB(std::uint8_t box, std::uint8_t src) {
+  PushRegInst(RegOpCode::STB, box, src, 0);
+}
+
+void CodeGen::CLOS(std::uint8_t dest, std::uint8_t base,
+                   std::uint8_t count, const std::string &label) {
+  PushRegInst(RegOpCode::CLOS, dest, base, count);
+  PushWord(GetFuncId(label));
+}
+
+void CodeGen::INV(std::uint8_t func, std::uint8_t base,
+                  std::uint8_t count) {
+  PushRegInst(RegOpCode::INV, func, base, count);
+}
+
+void CodeGen::TINV(std::uint8_t func, std::uint8_t base,
+                   std::uint8_t count) {
+  PushRegInst(RegOpCode::TINV, func, base, count);
+}
+
+void CodeGen::RTN(std::uint8_t src) {
+  PushRegInst(RegOpCode::RTN, src, 0, 0);
+}
+
+void CodeGen::DINV(std::uint8_t base, const std::string &label) {
+  auto pc_id = GetFuncId(label);
+  assert(pc_id <= UINT16_MAX);
+  PushRegInst(RegOpCode::DINV, pc_id & 0xff, base, pc_id >> 8);
+}
+
+void CodeGen::DTIV(std::uint8_t base, const std::string &label) {
+  auto pc_id = GetFuncId(label);
+  assert(pc_id <= UINT16_MAX);
+  PushRegInst(RegOpCode::DTIV, pc_id & 0xff, base, pc_id >> 8);
 }
 
 void CodeGen::LABEL(const std::string &label) {
@@ -251,13 +469,14 @@ void CodeGen::LABEL(const std::string &label) {
   }
 }
 
-void CodeGen::GetFuncValue(const std::string &name) {
+void CodeGen::GetFuncValue(const std::string &name,
+                           std::uint32_t capture_count) {
   SetConst(GetFuncId(name));
-  FUN();
+  FUN(capture_count);
 }
 
 void CodeGen::DefineFunction(const std::string &name) {
-  GetFuncValue(name);
+  GetFuncValue(name, 0);
   SET(name);
 }
 
@@ -272,43 +491,39 @@ void CodeGen::SetConst(std::int32_t num) {
   }
 }
 
-void CodeGen::GenReturn() {
-  if (last_op_ == OpCode::CALL) {
-    // modify opcode to TCAL
-    auto inst = PtrCast<Inst>(inst_buf_.data() + inst_buf_.size() - 1);
-    last_op_ = OpCode::TCAL;
-    inst->opcode = static_cast<std::uint32_t>(last_op_);
+void CodeGen::SetRegConst(std::uint8_t dest, std::int32_t num) {
+  if (num >= INT16_MIN && num <= INT16_MAX) {
+    LDI(dest, num);
   }
   else {
-    // just generate RET
-    RET();
+    LDK(dest, num);
   }
 }
 
-void CodeGen::SmartGet(const std::string &name) {
-  if (last_op_ == OpCode::SET) {
-    auto index = GetSymbolIndex(name);
-    // check if last instruction has same index
-    auto inst = PtrCast<Inst>(inst_buf_.data() + inst_buf_.size() - 4);
-    if (inst->opr == index) return;
-  }
-  // just generate GET
-  GET(name);
-}
-
 void CodeGen::RegisterGlobalFunction(const std::string &name,
                                      const std::string &label,
-                                     std::uint8_t arg_count) {
+                                     std::uint32_t arg_count) {
   // get function id
   assert(!name.empty() && name[0] == '$');
   auto func_id = GetSymbolIndex(name);
-  assert(global_funcs_.find(func_id) == global_funcs_.end());
   // initialize global func structure
   GlobalFunc func;
   // get function pc id
   func.pc_id = GetFuncId(label);
   // get argument count
   func.arg_count = arg_count;
-  // insert into table
-  global_funcs_.insert({func_id, func});
+  // insert into table, function may be redefined by the following
+  // code segments, the last definition will be used
+  global_funcs_[func_id] = func;
+}
+
+void CodeGen::RegisterFunctionInfo(const std::string &label,
+                                   std::uint32_t arg_count,
+                                   std::uint32_t slot_count) {
+  assert(arg_count <= slot_count);
+  // get function pc id
+  auto pc_id = GetFuncId(label);
+  if (pc_id >= func_infos_.size()) func_infos_.resize(pc_id + 1);
+  // update function info
+  func_infos_[pc_id] = {slot_count, arg_count};
 }
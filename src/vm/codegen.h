@@ -6,6 +6,7 @@
 #include <string>
 #include <forward_list>
 #include <cstdint>
+#include <cstddef>
 
 #include "vm/define.h"
 
@@ -14,74 +15,150 @@ namespace ionia::vm {
 // code generator of Ionia VM
 class CodeGen {
  public:
-  CodeGen() { Reset(); }
+  CodeGen() : mode_(CodeMode::Stack) { Reset(); }
   virtual ~CodeGen() = default;
 
-  // Function returns start position of bytecode segment.
-  // If error, returns -1.
-  static int ParseBytecode(const std::vector<std::uint8_t> &buffer,
-                           SymbolTable &sym_table, FuncPCTable &pc_table,
-                           GlobalFuncTable &global_funcs);
+  // parse bytecode to program, returns false if error
+  static bool ParseBytecode(const std::vector<std::uint8_t> &buffer,
+                            Program &program);
+  // serialize program to bytecode
+  static std::vector<std::uint8_t> SerializeProgram(const Program &program);
 
-  // generate bytecode vector
-  std::vector<std::uint8_t> GenerateBytecode();
+  // generate in-memory program, all tables and instructions are moved
+  // into the program, and generator is reset after generation
+  Program GenerateProgram();
   // generate bytecode to file
   void GenerateBytecodeFile(const std::string &file);
   // reset generator
   void Reset();
+  // start code segment at the end of instruction buffer,
+  // returns the beginning of the segment
+  std::size_t BeginSegment();
+  // finish code segment that starts at 'begin' of instruction buffer,
+  // code before it will never be changed, used when generating code
+  // incrementally, and tables are kept for the following segments
+  void FinishSegment(std::size_t begin);
+  // discard code segment that starts at 'begin' of instruction buffer,
+  // and all functions defined in it, symbols of the segment are kept
+  void DiscardSegment(std::size_t begin);
 
   // generate instructions
   void GET(const std::string &name);
   void SET(const std::string &name);
-  void FUN();
+  void FUN(std::uint32_t capture_count);
   void CNST(std::uint32_t num);
   void CNSH(std::uint32_t num);
   void PUSH();
   void POP();
   void RET();
-  void CALL();
-  void TCAL();
+  void CALL(std::uint32_t arg_count);
+  void TCAL(std::uint32_t arg_count);
+  void GETL(std::uint32_t index);
+  void SETL(std::uint32_t index);
+  void GETC(std::uint32_t index);
+  void BOX(std::uint32_t index);
+  void UNBX();
+  void SETB(std::uint32_t index);
+  // call known closed function directly, no callee value is needed
+  void DCAL(const std::string &label);
+  void DTCL(const std::string &label);
+
+  // generate instructions of register-based VM
+  void MOV(std::uint8_t dest, std::uint8_t src);
+  void LDI(std::uint8_t dest, std::int16_t num);
+  void LDK(std::uint8_t dest, std::int32_t num);
+  void LDG(std::uint8_t dest, const std::string &name);
+  void STG(std::uint8_t src, const std::string &name);
+  void LDC(std::uint8_t dest, std::uint16_t index);
+  void MKB(std::uint8_t reg);
+  void LDB(std::uint8_t dest, std::uint8_t box);
+  void STB(std::uint8_t box, std::uint8_t src);
+  void CLOS(std::uint8_t dest, std::uint8_t base, std::uint8_t count,
+            const std::string &label);
+  void INV(std::uint8_t func, std::uint8_t base, std::uint8_t count);
+  void TINV(std::uint8_t func, std::uint8_t base, std::uint8_t count);
+  void RTN(std::uint8_t src);
+  // pc id of callee is stored in operand 'a' (low) and 'c' (high)
+  void DINV(std::uint8_t base, const std::string &label);
+  void DTIV(std::uint8_t base, const std::string &label);
 
   // create a new label
   void LABEL(const std::string &label);
 
-  // get function value (pseudo instruction)
-  void GetFuncValue(const std::string &name);
+  // get function value, captured values must be pushed before
+  // (pseudo instruction)
+  void GetFuncValue(const std::string &name, std::uint32_t capture_count);
   // define function (pseudo instruction)
   void DefineFunction(const std::string &name);
   // set constant value (pseudo instruction)
   void SetConst(std::int32_t num);
-  // automatic generate RET or TCAL instruction (pseudo instruction)
-  void GenReturn();
-  // generate GET only when it's necessary (pseudo instruction)
-  void SmartGet(const std::string &name);
+  // load constant to register (pseudo instruction)
+  void SetRegConst(std::uint8_t dest, std::int32_t num);
   // register new global function
   void RegisterGlobalFunction(const std::string &name,
                               const std::string &label,
-                              std::uint8_t arg_count);
+                              std::uint32_t arg_count);
+  // register metadata of function
+  void RegisterFunctionInfo(const std::string &label,
+                            std::uint32_t arg_count,
+                            std::uint32_t slot_count);
+
+  // setters
+  // set mode of generated bytecode, will be kept after resetting
+  void set_mode(CodeMode mode) { mode_ = mode; }
+  // set slot count of the frame of top level code
+  void set_main_slot_count(std::uint32_t main_slots) {
+    main_slots_ = main_slots;
+  }
+
+  // getters
+  CodeMode mode() const { return mode_; }
+  std::uint32_t main_slots() const { return main_slots_; }
+  const SymbolTable &sym_table() const { return sym_table_; }
+  const FuncPCTable &pc_table() const { return pc_table_; }
+  const FuncInfoTable &func_infos() const { return func_infos_; }
+  // global functions, indexed by symbol index of function name
+  const std::map<std::uint32_t, GlobalFunc> &global_funcs() const {
+    return global_funcs_;
+  }
+  const std::vector<std::uint8_t> &insts() const { return inst_buf_; }
 
  private:
   // file header of Ionia VM's bytecode file (bad bite c -> bad byte code)
   static const std::uint32_t kFileHeader = 0xec17dbba;
-  // minimum bytecode file size (magic, version, ST len, FPT len, GFT len)
-  static const std::uint32_t kMinFileSize = 5 * 4;
+  // minimum version of compatible bytecode file (0.8.0)
+  static const std::uint32_t kMinVersionInfo = 8 << 12;
+  // minimum bytecode file size
+  // (magic, version, mode, main slots, ST len, FPT len, FIT len, GFT len)
+  static const std::uint32_t kMinFileSize = 8 * 4;
+  // size of function info table item
+  static const std::uint32_t kFITItemSize = 4 + 4;
   // size of global function table item
-  static const std::uint32_t kGFTItemSize = 4 + 4 + 1;
+  static const std::uint32_t kGFTItemSize = 4 + 4 + 4;
 
   std::uint32_t GetSymbolIndex(const std::string &name);
   void PushInst(OpCode op, std::uint32_t opr);
   void PushInst(OpCode op);
+  void PushRegInst(RegOpCode op, std::uint8_t a, std::uint8_t b,
+                   std::uint8_t c);
+  void PushWord(std::uint32_t word);
   std::uint32_t GetFuncId(const std::string &label);
 
   // tables
   SymbolTable sym_table_;
   FuncPCTable pc_table_;
+  FuncInfoTable func_infos_;
   std::map<std::uint32_t, GlobalFunc> global_funcs_;
   // buffer that stores instructions
   std::vector<std::uint8_t> inst_buf_;
-  OpCode last_op_;
+  // mode of bytecode
+  CodeMode mode_;
+  std::uint32_t main_slots_;
   // map of labels
   std::map<std::string, std::uint32_t> labels_, unfilled_;
+  // function count and global functions before current segment
+  std::size_t seg_func_count_;
+  std::map<std::uint32_t, GlobalFunc> seg_global_funcs_;
 };
 
 }  // namespace ionia::vm
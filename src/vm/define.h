@@ -7,26 +7,39 @@
 #include <string>
 #include <functional>
 #include <cstdint>
+#include <cstddef>
 #include <cassert>
 
 // all supported instructions of Ionia VM
 #define VM_INST_ALL(f)                  \
   f(GET) f(SET) f(FUN) f(CNST) f(CNSH)  \
-  f(PUSH) f(POP) f(RET) f(CALL) f(TCAL)
+  f(PUSH) f(POP) f(RET) f(CALL) f(TCAL)  \
+  f(GETL) f(SETL) f(GETC) f(BOX) f(UNBX)  \
+  f(SETB) f(DCAL) f(DTCL)
+// all supported instructions of register-based Ionia VM
+#define VM_REG_INST_ALL(f)                  \
+  f(MOV) f(LDI) f(LDK) f(LDG) f(STG) f(LDC)  \
+  f(MKB) f(LDB) f(STB) f(CLOS) f(INV) f(TINV) \
+  f(RTN) f(DINV) f(DTIV)
 // expand macro to comma-separated list
 #define VM_EXPAND_LIST(i)         i,
 // expand macro to comma-separated string array
 #define VM_EXPAND_STR_ARRAY(i)    #i,
+// expand macro to count of items
+#define VM_EXPAND_COUNT(i)        +1
 // expand macro to label list
 #define VM_EXPAND_LABEL_LIST(i)   &&VML_##i,
 // define a label of VM threading
 #define VM_LABEL(l)               VML_##l:
 // width of opcode field in Inst
-#define VM_INST_OPCODE_WIDTH      4
+#define VM_INST_OPCODE_WIDTH      5
 // width of oprand field in Inst
 #define VM_INST_OPR_WIDTH         (32 - VM_INST_OPCODE_WIDTH)
 // immediate number mask of Inst
 #define VM_INST_IMM_MASK          ((1 << VM_INST_OPR_WIDTH) - 1)
+// opcode mask of the first byte of Inst, short instructions
+// have only one byte, so opcode must be fetched from it
+#define VM_INST_OPCODE_MASK       ((1 << VM_INST_OPCODE_WIDTH) - 1)
 
 namespace ionia::vm {
 
@@ -43,6 +56,42 @@ struct Inst {
   std::uint32_t opr : VM_INST_OPR_WIDTH;
 };
 
+// enumeration of opcode of register-based VM
+enum class RegOpCode : std::uint8_t {
+  VM_REG_INST_ALL(VM_EXPAND_LIST)
+};
+
+// structure of register-based instruction
+// 32-bit operands (symbols, constants, function ids) are stored
+// in the word that follows the instruction
+struct RegInst {
+  std::uint8_t opcode;
+  // registers or immediate operands
+  std::uint8_t a, b, c;
+};
+
+// number of instructions
+constexpr std::uint32_t kInstCount = 0 VM_INST_ALL(VM_EXPAND_COUNT);
+constexpr std::uint32_t kRegInstCount = 0 VM_REG_INST_ALL(VM_EXPAND_COUNT);
+
+// check if instruction is one byte long
+inline bool IsShortInst(OpCode op) {
+  return op == OpCode::PUSH || op == OpCode::POP || op == OpCode::RET ||
+         op == OpCode::UNBX;
+}
+
+// check if register-based instruction is followed by a word
+inline bool IsLongRegInst(RegOpCode op) {
+  return op == RegOpCode::LDK || op == RegOpCode::LDG ||
+         op == RegOpCode::STG || op == RegOpCode::CLOS;
+}
+
+// mode of bytecode
+enum class CodeMode : std::uint32_t { Stack, Register };
+
+// maximum number of registers in a frame of register-based VM
+constexpr std::uint32_t kMaxRegCount = 256;
+
 // forward declaration of Env
 struct Env;
 using EnvPtr = std::shared_ptr<Env>;
@@ -53,30 +102,103 @@ struct Value {
   EnvPtr env;
 };
 
+// environment, also used as function frame, closure and box
 struct Env {
+  // named symbols (root environment & external functions)
   std::unordered_map<std::uint32_t, Value> slot;
+  // local slots of function frame, captured values of closure,
+  // or the only value in box
+  std::vector<Value> locals;
+  // closure of the function that owns the frame
   EnvPtr outer;
   std::uint32_t ret_pc;
+  // base of frame in register file, only used by register-based VM
+  std::uint32_t reg_base;
 };
 
 struct GlobalFunc {
   std::uint32_t pc_id;
-  std::uint8_t arg_count;
+  std::uint32_t arg_count;
+};
+
+struct FuncInfo {
+  // number of local slots, including arguments
+  std::uint32_t slot_count;
+  std::uint32_t arg_count;
+};
+
+// interned symbol table, maps symbols to indices and vice versa
+class SymbolTable {
+ public:
+  SymbolTable() {}
+  // names refer to nodes of hash map, so copying is not allowed
+  SymbolTable(const SymbolTable &) = delete;
+  SymbolTable &operator=(const SymbolTable &) = delete;
+  // moving keeps nodes of hash map, so names are still valid
+  SymbolTable(SymbolTable &&) = default;
+  SymbolTable &operator=(SymbolTable &&) = default;
+
+  // get index of symbol, add a new one if not found
+  std::uint32_t Intern(const std::string &name) {
+    auto index = static_cast<std::uint32_t>(names_.size());
+    auto ret = ids_.insert({name, index});
+    if (ret.second) names_.push_back(&ret.first->first);
+    return ret.first->second;
+  }
+
+  // find index of symbol, returns false if not found
+  bool Find(const std::string &name, std::uint32_t &index) const {
+    auto it = ids_.find(name);
+    if (it == ids_.end()) return false;
+    index = it->second;
+    return true;
+  }
+
+  // clear all symbols
+  void clear() {
+    ids_.clear();
+    names_.clear();
+  }
+
+  // getters
+  const std::string &operator[](std::uint32_t index) const {
+    return *names_[index];
+  }
+  std::size_t size() const { return names_.size(); }
+
+ private:
+  std::unordered_map<std::string, std::uint32_t> ids_;
+  std::vector<const std::string *> names_;
 };
 
 // definition of tables
-using SymbolTable = std::vector<std::string>;
 using FuncPCTable = std::vector<std::uint32_t>;
+using FuncInfoTable = std::vector<FuncInfo>;
 using GlobalFuncTable = std::unordered_map<std::string, GlobalFunc>;
 
+// program of Ionia VM, can be handed from code generator to VM directly,
+// or be serialized to/parsed from bytecode file
+struct Program {
+  // mode of bytecode & slot count of top level frame
+  CodeMode mode;
+  std::uint32_t main_slots;
+  // tables
+  SymbolTable sym_table;
+  FuncPCTable pc_table;
+  FuncInfoTable func_infos;
+  GlobalFuncTable global_funcs;
+  // instructions
+  std::vector<std::uint8_t> insts;
+};
+
 // make new VM environment
 inline EnvPtr MakeEnv() {
-  return std::make_shared<Env>(Env({{}, nullptr, 0}));
+  return std::make_shared<Env>(Env({{}, {}, nullptr, 0, 0}));
 }
 
 // make new VM environment with specific outer environment
 inline EnvPtr MakeEnv(const EnvPtr &outer) {
-  return std::make_shared<Env>(Env({{}, outer, 0}));
+  return std::make_shared<Env>(Env({{}, {}, outer, 0, 0}));
 }
 
 // make new VM integer value
@@ -1,7 +1,9 @@
 #include "vm/disasm.h"
 
 #include <fstream>
+#include <iterator>
 #include <iomanip>
+#include <utility>
 
 #include "vm/codegen.h"
 #include "util/cast.h"
@@ -18,11 +20,25 @@ constexpr const char *kInstOpName[] = {
   VM_INST_ALL(VM_EXPAND_STR_ARRAY)
 };
 
+constexpr const char *kRegInstOpName[] = {
+  VM_REG_INST_ALL(VM_EXPAND_STR_ARRAY)
+};
+
 inline void PrintInstOpName(std::ostream &os, OpCode op) {
   os << std::setw(6) << std::left << std::setfill(' ');
   os << kInstOpName[static_cast<int>(op)];
 }
 
+inline void PrintInstOpName(std::ostream &os, RegOpCode op) {
+  os << std::setw(6) << std::left << std::setfill(' ');
+  os << kRegInstOpName[static_cast<int>(op)];
+}
+
+inline void PrintReg(std::ostream &os, std::uint8_t reg, bool is_last) {
+  os << "r" << std::dec << static_cast<int>(reg);
+  if (!is_last) os << ", ";
+}
+
 inline void PrintPC(std::ostream &os, unsigned int pc, bool print_split) {
   os << std::hex << std::setw(8) << std::setfill('0') << std::right << pc;
   if (print_split) os << kSplit;
@@ -50,7 +66,7 @@ void Disassembler::PrintGlobalFuncs(std::ostream &os) {
   for (const auto &it : global_funcs_) {
     const auto &func = it.second;
     os << "  " << it.first << ", arg.count = ";
-    os << static_cast<int>(func.arg_count) << std::endl;
+    os << func.arg_count << std::endl;
   }
   os << std::endl;
 }
@@ -59,7 +75,11 @@ void Disassembler::PrintLabel(std::ostream &os) {
   // check if there is a function at current pc
   for (std::size_t i = 0; i < pc_table_.size(); ++i) {
     if (pc_table_[i] == pc_) {
-      os << std::endl << GetLabelName(i) << ":" << std::endl;
+      const auto &info = func_infos_[i];
+      os << std::endl << GetLabelName(i) << ":" << kSplit;
+      os << "; args = " << std::dec << info.arg_count;
+      os << ", slots = " << std::dec << info.slot_count;
+      os << std::endl;
     }
   }
 }
@@ -71,26 +91,46 @@ std::string Disassembler::GetLabelName(std::size_t index) {
   return "fun" + std::to_string(index);
 }
 
+void Disassembler::PrintSymbol(std::ostream &os, std::uint32_t index) {
+  if (index >= sym_table_.size()) {
+    // invalid symbol id
+    os << "INVALID";
+    ++error_num_;
+  }
+  else {
+    os << sym_table_[index];
+  }
+}
+
+void Disassembler::PrintFuncMark(std::ostream &os, std::uint32_t index) {
+  if (index >= pc_table_.size()) {
+    os << " (INVALID)";
+    ++error_num_;
+  }
+  else {
+    os << " (" << GetLabelName(index) << " at ";
+    PrintPC(os, pc_table_[index], false);
+    os << ")";
+  }
+}
+
 bool Disassembler::LoadBytecode(const std::string &file) {
   // open file
   std::ifstream ifs(file, std::ios::binary);
   if (!ifs.is_open()) return false;
   // read bytes
-  std::vector<std::uint8_t> buffer;
-  unsigned cur_byte = ifs.get();
-  while (cur_byte != std::char_traits<unsigned char>::eof()) {
-    buffer.push_back(cur_byte);
-    cur_byte = ifs.get();
-  }
+  std::vector<std::uint8_t> buffer(std::istreambuf_iterator<char>(ifs),
+                                   {});
   // parse tables
-  auto pos = CodeGen::ParseBytecode(buffer, sym_table_, pc_table_,
-                                    global_funcs_);
-  if (pos < 0) return false;
-  // copy bytecode segment
-  rom_.reserve(buffer.size() - pos);
-  for (std::size_t i = pos; i < buffer.size(); ++i) {
-    rom_.push_back(buffer[i]);
-  }
+  Program program;
+  if (!CodeGen::ParseBytecode(buffer, program)) return false;
+  mode_ = program.mode;
+  main_slots_ = program.main_slots;
+  sym_table_ = std::move(program.sym_table);
+  pc_table_ = std::move(program.pc_table);
+  func_infos_ = std::move(program.func_infos);
+  global_funcs_ = std::move(program.global_funcs);
+  rom_ = std::move(program.insts);
   // reset error counter & pc
   error_num_ = pc_ = 0;
   last_const_ = -1;
@@ -100,6 +140,7 @@ bool Disassembler::LoadBytecode(const std::string &file) {
 bool Disassembler::Disassemble(std::ostream &os) {
   // print GFT
   PrintGlobalFuncs(os);
+  if (mode_ == CodeMode::Register) return DisassembleReg(os);
   // print instructions
   while (pc_ < rom_.size()) {
     // fetch next instruction
@@ -110,17 +151,20 @@ bool Disassembler::Disassemble(std::ostream &os) {
     // print instruction
     auto opcode = static_cast<OpCode>(inst->opcode);
     switch (opcode) {
+      case OpCode::GETL: case OpCode::SETL: case OpCode::GETC:
+      case OpCode::BOX: case OpCode::SETB:
+      case OpCode::CALL: case OpCode::TCAL: {
+        PrintRawBytecode(os, inst, false);
+        PrintInstOpName(os, opcode);
+        os << std::dec << inst->opr;
+        last_const_ = -1;
+        pc_ += 4;
+        break;
+      }
       case OpCode::GET: case OpCode::SET: {
         PrintRawBytecode(os, inst, false);
         PrintInstOpName(os, opcode);
-        if (inst->opr >= sym_table_.size()) {
-          // invalid symbol id
-          os << "INVALID";
-          ++error_num_;
-        }
-        else {
-          os << sym_table_[inst->opr];
-        }
+        PrintSymbol(os, inst->opr);
         last_const_ = -1;
         pc_ += 4;
         break;
@@ -143,23 +187,29 @@ bool Disassembler::Disassemble(std::ostream &os) {
         pc_ += 4;
         break;
       }
-      case OpCode::FUN: case OpCode::RET:
-      case OpCode::PUSH: case OpCode::POP:
-      case OpCode::CALL: case OpCode::TCAL: {
-        PrintRawBytecode(os, inst, true);
+      case OpCode::FUN: {
+        PrintRawBytecode(os, inst, false);
         PrintInstOpName(os, opcode);
+        os << std::dec << inst->opr;
         // print function mark
-        if (opcode == OpCode::FUN && last_const_ != -1) {
-          if (static_cast<std::size_t>(last_const_) >= pc_table_.size()) {
-            os << "(INVALID)";
-            ++error_num_;
-          }
-          else {
-            os << "(" << GetLabelName(last_const_) << " at ";
-            PrintPC(os, pc_table_[last_const_], false);
-            os << ")";
-          }
-        }
+        if (last_const_ != -1) PrintFuncMark(os, last_const_);
+        last_const_ = -1;
+        pc_ += 4;
+        break;
+      }
+      case OpCode::DCAL: case OpCode::DTCL: {
+        PrintRawBytecode(os, inst, false);
+        PrintInstOpName(os, opcode);
+        os << std::dec << inst->opr;
+        PrintFuncMark(os, inst->opr);
+        last_const_ = -1;
+        pc_ += 4;
+        break;
+      }
+      case OpCode::RET: case OpCode::UNBX:
+      case OpCode::PUSH: case OpCode::POP: {
+        PrintRawBytecode(os, inst, true);
+        PrintInstOpName(os, opcode);
         last_const_ = -1;
         pc_ += 1;
         break;
@@ -178,3 +228,94 @@ bool Disassembler::Disassemble(std::ostream &os) {
   }
   return !error_num_;
 }
+
+bool Disassembler::DisassembleReg(std::ostream &os) {
+  os << "Register-based, top level slots = " << std::dec << main_slots_;
+  os << std::endl;
+  while (pc_ < rom_.size()) {
+    // fetch next instruction
+    auto inst = PtrCast<RegInst>(rom_.data() + pc_);
+    PrintLabel(os);
+    PrintPC(os, pc_, true);
+    PrintRawBytecode(os, PtrCast<Inst>(inst), false);
+    // get 32-bit operand
+    auto word = pc_ + 8 <= rom_.size()
+                    ? *IntPtrCast<32>(rom_.data() + pc_ + 4) : 0;
+    // print instruction
+    auto opcode = static_cast<RegOpCode>(inst->opcode);
+    switch (opcode) {
+      case RegOpCode::MOV: case RegOpCode::LDB: case RegOpCode::STB: {
+        PrintInstOpName(os, opcode);
+        PrintReg(os, inst->a, false);
+        PrintReg(os, inst->b, true);
+        pc_ += 4;
+        break;
+      }
+      case RegOpCode::LDI: case RegOpCode::LDC: {
+        PrintInstOpName(os, opcode);
+        PrintReg(os, inst->a, false);
+        auto imm = inst->b | (inst->c << 8);
+        if (opcode == RegOpCode::LDI) imm = static_cast<std::int16_t>(imm);
+        os << std::dec << imm;
+        pc_ += 4;
+        break;
+      }
+      case RegOpCode::LDK: {
+        PrintInstOpName(os, opcode);
+        PrintReg(os, inst->a, false);
+        os << std::dec << static_cast<std::int32_t>(word);
+        pc_ += 8;
+        break;
+      }
+      case RegOpCode::LDG: case RegOpCode::STG: {
+        PrintInstOpName(os, opcode);
+        PrintReg(os, inst->a, false);
+        PrintSymbol(os, word);
+        pc_ += 8;
+        break;
+      }
+      case RegOpCode::MKB: case RegOpCode::RTN: {
+        PrintInstOpName(os, opcode);
+        PrintReg(os, inst->a, true);
+        pc_ += 4;
+        break;
+      }
+      case RegOpCode::CLOS: {
+        PrintInstOpName(os, opcode);
+        PrintReg(os, inst->a, false);
+        PrintReg(os, inst->b, false);
+        os << std::dec << static_cast<int>(inst->c);
+        // print function mark
+        PrintFuncMark(os, word);
+        pc_ += 8;
+        break;
+      }
+      case RegOpCode::DINV: case RegOpCode::DTIV: {
+        PrintInstOpName(os, opcode);
+        PrintReg(os, inst->b, false);
+        auto pc_id = inst->a | (inst->c << 8);
+        os << std::dec << pc_id;
+        PrintFuncMark(os, pc_id);
+        pc_ += 4;
+        break;
+      }
+      case RegOpCode::INV: case RegOpCode::TINV: {
+        PrintInstOpName(os, opcode);
+        PrintReg(os, inst->a, false);
+        PrintReg(os, inst->b, false);
+        os << std::dec << static_cast<int>(inst->c);
+        pc_ += 4;
+        break;
+      }
+      default: {
+        os << "UNKNOWN";
+        error_num_ += 1;
+        pc_ += 4;
+        break;
+      }
+    }
+    // print line break
+    os << std::endl;
+  }
+  return !error_num_;
+}
@@ -30,13 +30,23 @@ class Disassembler {
   void PrintLabel(std::ostream &os);
   // get label name via FPT index
   std::string GetLabelName(std::size_t index);
+  // print symbol name via symbol index
+  void PrintSymbol(std::ostream &os, std::uint32_t index);
+  // print label name and pc of function via FPT index
+  void PrintFuncMark(std::ostream &os, std::uint32_t index);
+  // disassemble register-based bytecode
+  bool DisassembleReg(std::ostream &os);
 
   std::vector<std::uint8_t> rom_;
   unsigned int error_num_, pc_;
   std::int64_t last_const_;
+  // mode of bytecode & slot count of top level frame
+  CodeMode mode_;
+  std::uint32_t main_slots_;
   // tables
   SymbolTable sym_table_;
   FuncPCTable pc_table_;
+  FuncInfoTable func_infos_;
   GlobalFuncTable global_funcs_;
 };
 
@@ -0,0 +1,167 @@
+#include "vm/peephole.h"
+
+#include <set>
+#include <utility>
+#include <cstring>
+#include <cstddef>
+
+using namespace ionia::vm;
+
+namespace {
+
+// decoded instruction
+struct InstInfo {
+  OpCode op;
+  std::uint32_t opr;
+  // offset in buffer and length
+  std::uint32_t pos, len;
+  // set if instruction is removed
+  bool removed;
+};
+
+// what is known about the value register
+struct ValueInfo {
+  enum class Kind { Unknown, Const, Global, Local } kind;
+  // constant value, symbol index or slot index
+  std::int32_t value;
+
+  bool Is(Kind k, std::int32_t v) const { return kind == k && value == v; }
+};
+
+using Kind = ValueInfo::Kind;
+
+// decode all instructions in buffer from 'begin'
+std::vector<InstInfo> DecodeInsts(const std::vector<std::uint8_t> &buf,
+                                  std::size_t begin) {
+  std::vector<InstInfo> insts;
+  std::size_t pos = begin;
+  while (pos < buf.size()) {
+    Inst inst = {0, 0};
+    auto len = buf.size() - pos < 4 ? buf.size() - pos : 4;
+    std::memcpy(&inst, buf.data() + pos, len);
+    auto op = static_cast<OpCode>(inst.opcode);
+    std::uint32_t inst_len = IsShortInst(op) ? 1 : 4;
+    insts.push_back({op, inst.opr, static_cast<std::uint32_t>(pos),
+                     inst_len, false});
+    pos += inst_len;
+  }
+  return insts;
+}
+
+// get constant value after 'CNST opr'
+std::int32_t ApplyCNST(std::uint32_t opr) {
+  std::int32_t value = opr;
+  if (opr & (1 << (VM_INST_OPR_WIDTH - 1))) value |= ~VM_INST_IMM_MASK;
+  return value;
+}
+
+// get constant value after 'CNSH opr'
+std::int32_t ApplyCNSH(std::int32_t value, std::uint32_t opr) {
+  return (value & VM_INST_IMM_MASK) | (opr << VM_INST_OPCODE_WIDTH);
+}
+
+}  // namespace
+
+void ionia::vm::OptimizeStackInsts(std::vector<std::uint8_t> &insts,
+                                   FuncPCTable &pc_table,
+                                   std::size_t begin) {
+  auto infos = DecodeInsts(insts, begin);
+  std::set<std::uint32_t> labels(pc_table.begin(), pc_table.end());
+  // check if the next instruction is in the same function
+  auto next = [&](std::size_t i, OpCode op) {
+    return i + 1 < infos.size() && infos[i + 1].op == op &&
+           !labels.count(infos[i + 1].pos);
+  };
+  ValueInfo val = {Kind::Unknown, 0};
+  for (std::size_t i = 0; i < infos.size(); ++i) {
+    auto &inst = infos[i];
+    if (labels.count(inst.pos)) val.kind = Kind::Unknown;
+    switch (inst.op) {
+      case OpCode::CNST: {
+        auto value = ApplyCNST(inst.opr);
+        if (next(i, OpCode::CNSH)) {
+          auto &hi = infos[++i];
+          auto full = ApplyCNSH(value, hi.opr);
+          if (val.Is(Kind::Const, full)) {
+            // constant is already in value register
+            inst.removed = hi.removed = true;
+          }
+          else if (full == value) {
+            // high part has already been set by sign extension
+            hi.removed = true;
+          }
+          else if (val.kind == Kind::Const &&
+                   ApplyCNSH(val.value, hi.opr) == full) {
+            // low part is already in value register
+            inst.removed = true;
+          }
+          value = full;
+        }
+        else if (val.Is(Kind::Const, value)) {
+          inst.removed = true;
+        }
+        val = {Kind::Const, value};
+        break;
+      }
+      case OpCode::CNSH: {
+        if (val.kind == Kind::Const) {
+          auto value = ApplyCNSH(val.value, inst.opr);
+          if (value == val.value) inst.removed = true;
+          val.value = value;
+        }
+        else {
+          val.kind = Kind::Unknown;
+        }
+        break;
+      }
+      case OpCode::GET: {
+        // value register already holds the global variable
+        auto sym = static_cast<std::int32_t>(inst.opr);
+        if (val.Is(Kind::Global, sym)) inst.removed = true;
+        val = {Kind::Global, sym};
+        break;
+      }
+      case OpCode::SET: {
+        val = {Kind::Global, static_cast<std::int32_t>(inst.opr)};
+        break;
+      }
+      case OpCode::GETL: case OpCode::SETL: {
+        // value register and local slot already hold the same value
+        auto slot = static_cast<std::int32_t>(inst.opr);
+        if (val.Is(Kind::Local, slot)) inst.removed = true;
+        val = {Kind::Local, slot};
+        break;
+      }
+      case OpCode::BOX: {
+        // local slot will be replaced by a box
+        auto slot = static_cast<std::int32_t>(inst.opr);
+        if (val.Is(Kind::Local, slot)) val.kind = Kind::Unknown;
+        break;
+      }
+      case OpCode::PUSH: {
+        if (next(i, OpCode::POP)) {
+          inst.removed = infos[++i].removed = true;
+        }
+        break;
+      }
+      // value register is not changed
+      case OpCode::SETB: break;
+      default: val.kind = Kind::Unknown; break;
+    }
+  }
+  // generate new buffer and offset map of labels
+  std::vector<std::uint8_t> new_insts(insts.begin(), insts.begin() + begin);
+  std::vector<std::uint32_t> offsets(insts.size() + 1);
+  new_insts.reserve(insts.size());
+  for (const auto &inst : infos) {
+    offsets[inst.pos] = new_insts.size();
+    if (inst.removed) continue;
+    auto begin = insts.begin() + inst.pos;
+    new_insts.insert(new_insts.end(), begin, begin + inst.len);
+  }
+  offsets[insts.size()] = new_insts.size();
+  for (auto &pc : pc_table) {
+    if (pc >= begin) pc = offsets[pc];
+  }
+  insts = std::move(new_insts);
+}
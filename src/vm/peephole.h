@@ -0,0 +1,24 @@
+#ifndef IONIA_VM_PEEPHOLE_H_
+#define IONIA_VM_PEEPHOLE_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "vm/define.h"
+
+namespace ionia::vm {
+
+// peephole optimizer of stack-based bytecode
+// runs on the finished instructions from 'begin' to the end of buffer,
+// removes instructions that do not change the state of VM, and updates
+// offsets in function pc table, instructions before 'begin' are kept
+//
+// value register is tracked inside each function, and forgotten
+// at the start of each function since functions can be reached by calls
+void OptimizeStackInsts(std::vector<std::uint8_t> &insts,
+                        FuncPCTable &pc_table, std::size_t begin);
+
+}  // namespace ionia::vm
+
+#endif  // IONIA_VM_PEEPHOLE_H_
@@ -0,0 +1,178 @@
+#include "vm/verifier.h"
+
+#include <cstring>
+
+using namespace ionia::vm;
+
+bool Verifier::VerifyEntry(std::uint32_t entry, std::uint32_t main_slots) {
+  return Verify(entry, main_slots);
+}
+
+bool Verifier::VerifyFuncs(std::size_t begin) {
+  if (func_infos_.size() != pc_table_.size()) return false;
+  for (auto i = begin; i < pc_table_.size(); ++i) {
+    const auto &info = func_infos_[i];
+    if (info.arg_count > info.slot_count) return false;
+    if (!Verify(pc_table_[i], info.slot_count)) return false;
+  }
+  return true;
+}
+
+bool Verifier::Verify(std::uint32_t pc, std::uint32_t slot_count) {
+  // slots must be addressable by instructions
+  auto max_slots = mode_ == CodeMode::Register ? kMaxRegCount
+                                               : 1u << VM_INST_OPR_WIDTH;
+  if (slot_count > max_slots) return false;
+  return mode_ == CodeMode::Register ? VerifyRegister(pc, slot_count)
+                                     : VerifyStack(pc, slot_count);
+}
+
+bool Verifier::VerifyStack(std::uint32_t pc, std::uint32_t slot_count) {
+  // depth of value stack in current frame
+  std::uint32_t depth = 0;
+  // constant in value register, 'FUN' takes function id from it
+  bool is_const = false;
+  std::int32_t value = 0;
+  while (pc < insts_.size()) {
+    // decode instruction
+    Inst inst = {0, 0};
+    auto len = insts_.size() - pc < 4 ? insts_.size() - pc : 4;
+    std::memcpy(&inst, insts_.data() + pc, len);
+    if (inst.opcode >= kInstCount) return false;
+    auto op = static_cast<OpCode>(inst.opcode);
+    std::size_t inst_len = IsShortInst(op) ? 1 : 4;
+    if (pc + inst_len > insts_.size()) return false;
+    // check operands & value stack
+    auto keep_const = false;
+    switch (op) {
+      case OpCode::GET: case OpCode::SET: {
+        if (inst.opr >= sym_count_) return false;
+        keep_const = op == OpCode::SET;
+        break;
+      }
+      case OpCode::FUN: {
+        if (!is_const || static_cast<std::uint32_t>(value) >=
+                             pc_table_.size()) {
+          return false;
+        }
+        if (depth < inst.opr) return false;
+        depth -= inst.opr;
+        break;
+      }
+      case OpCode::CNST: {
+        value = inst.opr;
+        if (inst.opr & (1 << (VM_INST_OPR_WIDTH - 1))) {
+          value |= ~VM_INST_IMM_MASK;
+        }
+        is_const = keep_const = true;
+        break;
+      }
+      case OpCode::CNSH: {
+        value &= VM_INST_IMM_MASK;
+        value |= inst.opr << VM_INST_OPCODE_WIDTH;
+        keep_const = true;
+        break;
+      }
+      case OpCode::PUSH: {
+        ++depth;
+        keep_const = true;
+        break;
+      }
+      case OpCode::POP: {
+        if (!depth) return false;
+        --depth;
+        break;
+      }
+      case OpCode::CALL: {
+        if (depth < inst.opr) return false;
+        depth -= inst.opr;
+        break;
+      }
+      case OpCode::GETL: case OpCode::SETL: case OpCode::BOX:
+      case OpCode::SETB: {
+        if (inst.opr >= slot_count) return false;
+        keep_const = op != OpCode::GETL;
+        break;
+      }
+      case OpCode::DCAL: case OpCode::DTCL: {
+        if (inst.opr >= pc_table_.size()) return false;
+        auto arg_count = func_infos_[inst.opr].arg_count;
+        if (op == OpCode::DTCL) return depth == arg_count;
+        if (depth < arg_count) return false;
+        depth -= arg_count;
+        break;
+      }
+      // value stack must be empty when leaving function
+      case OpCode::RET: return !depth;
+      case OpCode::TCAL: return depth == inst.opr;
+      default: break;
+    }
+    is_const = is_const && keep_const;
+    pc += inst_len;
+  }
+  // ran out of instruction buffer
+  return false;
+}
+
+bool Verifier::VerifyRegister(std::uint32_t pc, std::uint32_t slot_count) {
+  auto is_reg = [slot_count](std::uint32_t reg) { return reg < slot_count; };
+  while (pc + 4 <= insts_.size()) {
+    // decode instruction
+    RegInst inst;
+    std::memcpy(&inst, insts_.data() + pc, 4);
+    if (inst.opcode >= kRegInstCount) return false;
+    auto op = static_cast<RegOpCode>(inst.opcode);
+    std::size_t inst_len = 4;
+    std::uint32_t word = 0;
+    if (IsLongRegInst(op)) {
+      if (pc + 8 > insts_.size()) return false;
+      std::memcpy(&word, insts_.data() + pc + 4, 4);
+      inst_len = 8;
+    }
+    // check operands
+    switch (op) {
+      case RegOpCode::MOV: case RegOpCode::LDB: case RegOpCode::STB: {
+        if (!is_reg(inst.a) || !is_reg(inst.b)) return false;
+        break;
+      }
+      case RegOpCode::LDI: case RegOpCode::LDK: case RegOpCode::LDC:
+      case RegOpCode::MKB: {
+        if (!is_reg(inst.a)) return false;
+        break;
+      }
+      case RegOpCode::LDG: case RegOpCode::STG: {
+        if (!is_reg(inst.a) || word >= sym_count_) return false;
+        break;
+      }
+      case RegOpCode::CLOS: {
+        if (!is_reg(inst.a) || word >= pc_table_.size()) return false;
+        if (inst.c && inst.b + inst.c > slot_count) return false;
+        break;
+      }
+      case RegOpCode::INV: case RegOpCode::TINV: {
+        if (!is_reg(inst.a) || !is_reg(inst.b) ||
+            inst.b + inst.c > slot_count) {
+          return false;
+        }
+        if (op == RegOpCode::TINV) return true;
+        break;
+      }
+      case RegOpCode::DINV: case RegOpCode::DTIV: {
+        std::uint32_t pc_id = inst.a | (inst.c << 8);
+        if (pc_id >= pc_table_.size()) return false;
+        if (inst.b + func_infos_[pc_id].arg_count > slot_count) {
+          return false;
+        }
+        // result is stored to base register after returning
+        if (op == RegOpCode::DTIV) return true;
+        if (!is_reg(inst.b)) return false;
+        break;
+      }
+      case RegOpCode::RTN: return is_reg(inst.a);
+      default: break;
+    }
+    pc += inst_len;
+  }
+  // ran out of instruction buffer
+  return false;
+}
@@ -0,0 +1,46 @@
+#ifndef IONIA_VM_VERIFIER_H_
+#define IONIA_VM_VERIFIER_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "vm/define.h"
+
+namespace ionia::vm {
+
+// load-time verifier of bytecode
+// functions have no jumps, so each of them is checked by walking from
+// its entry to the first terminator (RET, TCAL, DTCL, RTN, TINV, DTIV),
+// verified code never runs out of instruction buffer, only accesses
+// valid symbols, functions, local slots and registers, and keeps value
+// stack balanced in stack-based mode
+class Verifier {
+ public:
+  Verifier(CodeMode mode, const std::vector<std::uint8_t> &insts,
+           std::size_t sym_count, const FuncPCTable &pc_table,
+           const FuncInfoTable &func_infos)
+      : mode_(mode), insts_(insts), sym_count_(sym_count),
+        pc_table_(pc_table), func_infos_(func_infos) {}
+
+  // verify top level code that starts at 'entry'
+  bool VerifyEntry(std::uint32_t entry, std::uint32_t main_slots);
+  // verify all functions whose ids are not less than 'begin'
+  bool VerifyFuncs(std::size_t begin);
+
+ private:
+  // verify code starts at 'pc' with frame of 'slot_count' slots
+  bool Verify(std::uint32_t pc, std::uint32_t slot_count);
+  bool VerifyStack(std::uint32_t pc, std::uint32_t slot_count);
+  bool VerifyRegister(std::uint32_t pc, std::uint32_t slot_count);
+
+  CodeMode mode_;
+  const std::vector<std::uint8_t> &insts_;
+  std::size_t sym_count_;
+  const FuncPCTable &pc_table_;
+  const FuncInfoTable &func_infos_;
+};
+
+}  // namespace ionia::vm
+
+#endif  // IONIA_VM_VERIFIER_H_
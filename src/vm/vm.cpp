@@ -3,16 +3,57 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <iterator>
+#include <algorithm>
 #include <utility>
 #include <cassert>
 #include <cstddef>
+#include <cstring>
 
 #include "vm/codegen.h"
+#include "vm/verifier.h"
 #include "util/cast.h"
 
 using namespace ionia::vm;
 using namespace ionia::util;
 
+namespace {
+
+// features of dispatch loop, disabled features cost nothing
+template <bool Checked, bool Profile, bool Trace>
+struct DispatchPolicy {
+  // check bytecode at runtime
+  static constexpr bool kChecked = Checked;
+  // count executed instructions
+  static constexpr bool kProfile = Profile;
+  // print each executed instruction
+  static constexpr bool kTrace = Trace;
+};
+
+// policies of all flavors
+using FastPolicy = DispatchPolicy<false, false, false>;
+using CheckedPolicy = DispatchPolicy<true, false, false>;
+using ProfiledPolicy = DispatchPolicy<true, true, false>;
+using TracedPolicy = DispatchPolicy<true, false, true>;
+
+// names of instructions
+const char *kInstNames[] = {VM_INST_ALL(VM_EXPAND_STR_ARRAY)};
+const char *kRegInstNames[] = {VM_REG_INST_ALL(VM_EXPAND_STR_ARRAY)};
+
+// get name of instruction by opcode
+const char *GetInstName(CodeMode mode, std::uint32_t opcode) {
+  if (mode == CodeMode::Register) {
+    constexpr auto count = sizeof(kRegInstNames) / sizeof(const char *);
+    return opcode < count ? kRegInstNames[opcode] : "UNKNOWN";
+  }
+  else {
+    constexpr auto count = sizeof(kInstNames) / sizeof(const char *);
+    return opcode < count ? kInstNames[opcode] : "UNKNOWN";
+  }
+}
+
+}  // namespace
+
 bool VM::PrintError(const char *message) {
   std::cerr << "[ERROR] " << message << ", pc = ";
   std::cerr << std::hex << std::setw(8) << std::setfill('0') << pc_;
@@ -32,6 +73,10 @@ void VM::InitExtFuncs() {
   // reset ext environment
   ext_ = MakeEnv();
   root_->outer = ext_;
+  AddStdFuncs();
+}
+
+void VM::AddStdFuncs() {
   // try to set up all Ionia standard functions
   BindExtFunc("<<<", &VM::IonPrint);
   BindExtFunc(">>>", &VM::IonInput);
@@ -59,11 +104,12 @@ void VM::InitExtFuncs() {
   BindExtFunc("!", &VM::IonCalcOp, Operator::LogicNot);
 }
 
-bool VM::GetEnvValue(Inst *inst, Value &value) {
-  auto cur_env = envs_.top();
-  // recursively find value in environments
+bool VM::GetEnvValue(std::uint32_t sym, Value &value) {
+  // local variables are stored in frame slots,
+  // so only root and ext environment need to be searched
+  auto cur_env = root_;
   while (cur_env) {
-    auto it = cur_env->slot.find(inst->opr);
+    auto it = cur_env->slot.find(sym);
     if (it != cur_env->slot.end()) {
       value = it->second;
       return true;
@@ -73,118 +119,322 @@ bool VM::GetEnvValue(Inst *inst, Value &value) {
     }
   }
   // try to handle symbol error by calling symbol error handler
-  auto str = sym_table_[inst->opr];
+  if (sym >= sym_table_.size()) return PrintError("invalid symbol");
+  auto str = sym_table_[sym];
   if (sym_error_handler_ && sym_error_handler_(str, value)) return true;
   // value not found
   return PrintError("not found", str.c_str());
 }
 
-bool VM::DoCall(const Value &func) {
+template <bool kChecked>
+bool VM::InitFrame(const Value &func, std::uint32_t arg_count,
+                   const EnvPtr &frame) {
+  // function ids of closures are proved by verifier
+  if constexpr (kChecked) {
+    if (static_cast<std::size_t>(func.value) >= pc_table_.size()) {
+      return PrintError("invalid function pc");
+    }
+  }
+  // check argument count
+  if (arg_count != func_infos_[func.value].arg_count) {
+    return PrintError("argument count mismatch");
+  }
+  return EnterFrame<kChecked>(func.value, func.env, frame);
+}
+
+template <bool kChecked>
+bool VM::EnterFrame(std::uint32_t pc_id, const EnvPtr &outer,
+                    const EnvPtr &frame) {
+  const auto &info = func_infos_[pc_id];
+  if constexpr (kChecked) {
+    if (vals_.size() < info.arg_count) {
+      return PrintError("too few arguments");
+    }
+  }
+  // allocate all slots at once
+  frame->locals.assign(info.slot_count, {0, nullptr});
+  frame->outer = outer;
+  // move arguments to the first slots, the last argument is
+  // on the top of stack
+  auto args = vals_.end() - info.arg_count;
+  std::move(args, vals_.end(), frame->locals.begin());
+  vals_.erase(args, vals_.end());
+  pc_ = pc_table_[pc_id];
+  return true;
+}
+
+template <bool kChecked>
+bool VM::DoCall(const Value &func, std::uint32_t arg_count) {
   // check if is not a function
   if (!func.env) return PrintError("calling a non-function");
   // check if is an external function
   auto it = ext_funcs_.find(func.value);
   if (it != ext_funcs_.end()) {
-    // call external function
-    envs_.push(MakeEnv());
-    envs_.top()->ret_pc = pc_ + 1;
-    if (!it->second(vals_, val_reg_)) {
-      return PrintError("invalid function call");
+    // call external function, then call the returned function
+    // in place of it if necessary
+    if (!DoExtCall(it->second, arg_count)) return false;
+    if (ext_tail_call_) {
+      ext_tail_call_ = false;
+      auto next = val_reg_;
+      return DoCall<kChecked>(next, 0);
     }
-    pc_ = envs_.top()->ret_pc;
-    envs_.pop();
+    pc_ += 4;
   }
   else {
     // set up environment
-    envs_.push(MakeEnv(func.env));
-    envs_.top()->ret_pc = pc_ + 1;
-    if (static_cast<std::size_t>(func.value) >= pc_table_.size()) {
-      return PrintError("invalid function pc");
-    }
-    pc_ = pc_table_[func.value];
+    auto frame = MakeEnv();
+    frame->ret_pc = pc_ + 4;
+    if (!InitFrame<kChecked>(func, arg_count, frame)) return false;
+    envs_.push(std::move(frame));
   }
   return true;
 }
 
-bool VM::DoTailCall(const Value &func) {
+template <bool kChecked>
+bool VM::DoTailCall(const Value &func, std::uint32_t arg_count) {
   // check if is not a function
   if (!func.env) return PrintError("calling a non-function");
   // check if is an external function
   auto it = ext_funcs_.find(func.value);
   if (it != ext_funcs_.end()) {
     // call external function
-    if (!it->second(vals_, val_reg_)) {
-      return PrintError("invalid function call");
+    if (!DoExtCall(it->second, arg_count)) return false;
+    if (ext_tail_call_) {
+      ext_tail_call_ = false;
+      auto next = val_reg_;
+      return DoTailCall<kChecked>(next, 0);
     }
+    // return from current frame
     pc_ = envs_.top()->ret_pc;
     envs_.pop();
   }
   else {
-    // TODO: if there is an infinite loop, system will run out of memory
-    // switch environment
-    auto env = MakeEnv(func.env);
-    env->ret_pc = envs_.top()->ret_pc;
-    envs_.top() = std::move(env);
+    // closures never reference frames, so just reuse current frame
+    if (!InitFrame<kChecked>(func, arg_count, envs_.top())) return false;
+  }
+  return true;
+}
+
+template <bool kChecked>
+bool VM::DoDirectCall(std::uint32_t pc_id) {
+  if constexpr (kChecked) {
+    if (pc_id >= pc_table_.size()) return PrintError("invalid function pc");
+  }
+  // known functions are closed, so they share the root environment
+  auto frame = MakeEnv();
+  frame->ret_pc = pc_ + 4;
+  if (!EnterFrame<kChecked>(pc_id, root_, frame)) return false;
+  envs_.push(std::move(frame));
+  return true;
+}
+
+template <bool kChecked>
+bool VM::DoDirectTailCall(std::uint32_t pc_id) {
+  if constexpr (kChecked) {
+    if (pc_id >= pc_table_.size()) return PrintError("invalid function pc");
+  }
+  return EnterFrame<kChecked>(pc_id, root_, envs_.top());
+}
+
+bool VM::DoExtCall(const ExtFunc &func, std::uint32_t arg_count) {
+  if (vals_.size() < arg_count) return PrintError("too few arguments");
+  // arguments are already in order on the top of stack
+  auto args = vals_.size() - arg_count;
+  auto ret = func(vals_.data() + args, arg_count, val_reg_);
+  vals_.resize(args);
+  if (!ret) return PrintError("invalid function call");
+  return true;
+}
+
+template <bool kChecked>
+bool VM::InitRegFrame(const Value &func, std::uint32_t args,
+                      std::uint32_t arg_count, std::uint32_t base,
+                      const EnvPtr &frame) {
+  if constexpr (kChecked) {
     if (static_cast<std::size_t>(func.value) >= pc_table_.size()) {
       return PrintError("invalid function pc");
     }
-    pc_ = pc_table_[func.value];
   }
+  // check argument count
+  if (arg_count != func_infos_[func.value].arg_count) {
+    return PrintError("argument count mismatch");
+  }
+  EnterRegFrame(func.value, func.env, args, base, frame);
   return true;
 }
 
-bool VM::IonPrint(ValueStack &vals, Value &ret) {
-  if (vals.size() < 1) return false;
-  const auto &v = vals.top();
-  if (v.env) {
-    std::cout << "<function at: 0x";
-    std::cout << std::hex << std::setw(8) << std::setfill('0');
-    std::cout << v.value << ">" << std::endl;
+void VM::EnterRegFrame(std::uint32_t pc_id, const EnvPtr &outer,
+                       std::uint32_t args, std::uint32_t base,
+                       const EnvPtr &frame) {
+  const auto &info = func_infos_[pc_id];
+  // grow register file if necessary
+  auto top = base + info.slot_count;
+  if (top > regs_.size()) {
+    regs_.resize(std::max<std::size_t>(top, regs_.size() * 2));
   }
-  else {
-    std::cout << std::dec << v.value << std::endl;
+  // copy arguments to the first registers, arguments of tail call are
+  // in current frame, and they never come before the first registers
+  auto regs = regs_.data();
+  if (args != base) {
+    for (std::uint32_t i = 0; i < info.arg_count; ++i) {
+      regs[base + i] = regs[args + i];
+    }
+  }
+  for (auto i = base + info.arg_count; i < top; ++i) regs[i] = {0, nullptr};
+  frame->outer = outer;
+  frame->reg_base = base;
+  reg_top_ = top;
+  pc_ = pc_table_[pc_id];
+}
+
+template <bool kChecked>
+bool VM::DoRegCallFunc(const Value &func, std::uint32_t args,
+                       std::uint32_t arg_count, bool is_tail) {
+  // check if is not a function
+  if (!func.env) return PrintError("calling a non-function");
+  // check if is an external function
+  auto it = ext_funcs_.find(func.value);
+  if (it != ext_funcs_.end()) {
+    // arguments are passed from register file directly
+    if (!it->second(regs_.data() + args, arg_count, val_reg_)) {
+      return PrintError("invalid function call");
+    }
+    // call the returned function in place of external function
+    if (ext_tail_call_) {
+      ext_tail_call_ = false;
+      auto next = val_reg_;
+      return DoRegCallFunc<kChecked>(next, args, 0, is_tail);
+    }
+    // return result from current frame, or store it to base register
+    if (is_tail) return DoRegReturn<kChecked>();
+    regs_[args] = val_reg_;
+    pc_ += 4;
+    return true;
   }
-  ret = v;
-  vals.pop();
+  if (is_tail) {
+    // closures never reference frames, so just reuse current frame
+    const auto &frame = envs_.top();
+    return InitRegFrame<kChecked>(func, args, arg_count, frame->reg_base,
+                                  frame);
+  }
+  // set up a new frame after current one
+  auto frame = MakeEnv();
+  frame->ret_pc = pc_ + 4;
+  if (!InitRegFrame<kChecked>(func, args, arg_count, reg_top_, frame)) {
+    return false;
+  }
+  envs_.push(std::move(frame));
+  return true;
+}
+
+template <bool kChecked>
+bool VM::DoRegCall(const RegInst *inst) {
+  auto base = envs_.top()->reg_base;
+  if constexpr (kChecked) {
+    if (base + inst->a >= reg_top_ || base + inst->b >= reg_top_ ||
+        base + inst->b + inst->c > reg_top_) {
+      return PrintError("invalid register");
+    }
+  }
+  auto func = regs_[base + inst->a];
+  return DoRegCallFunc<kChecked>(func, base + inst->b, inst->c, false);
+}
+
+template <bool kChecked>
+bool VM::DoRegTailCall(const RegInst *inst) {
+  auto base = envs_.top()->reg_base;
+  if constexpr (kChecked) {
+    if (base + inst->a >= reg_top_ || base + inst->b >= reg_top_ ||
+        base + inst->b + inst->c > reg_top_) {
+      return PrintError("invalid register");
+    }
+  }
+  auto func = regs_[base + inst->a];
+  return DoRegCallFunc<kChecked>(func, base + inst->b, inst->c, true);
+}
+
+template <bool kChecked>
+bool VM::DoRegDirectCall(const RegInst *inst) {
+  std::uint32_t pc_id = inst->a | (inst->c << 8);
+  auto base = envs_.top()->reg_base;
+  if constexpr (kChecked) {
+    if (pc_id >= pc_table_.size()) return PrintError("invalid function pc");
+    if (base + inst->b + func_infos_[pc_id].arg_count > reg_top_) {
+      return PrintError("invalid register");
+    }
+  }
+  // known functions are closed, so they share the root environment
+  auto frame = MakeEnv();
+  frame->ret_pc = pc_ + 4;
+  EnterRegFrame(pc_id, root_, base + inst->b, reg_top_, frame);
+  envs_.push(std::move(frame));
+  return true;
+}
+
+template <bool kChecked>
+bool VM::DoRegDirectTailCall(const RegInst *inst) {
+  std::uint32_t pc_id = inst->a | (inst->c << 8);
+  const auto &frame = envs_.top();
+  auto base = frame->reg_base;
+  if constexpr (kChecked) {
+    if (pc_id >= pc_table_.size()) return PrintError("invalid function pc");
+    if (base + inst->b + func_infos_[pc_id].arg_count > reg_top_) {
+      return PrintError("invalid register");
+    }
+  }
+  EnterRegFrame(pc_id, root_, base + inst->b, base, frame);
+  return true;
+}
+
+template <bool kChecked>
+bool VM::DoRegReturn() {
+  const auto &frame = envs_.top();
+  pc_ = frame->ret_pc;
+  // registers of current frame are released
+  reg_top_ = frame->reg_base;
+  envs_.pop();
+  // returned from the first frame, exit from VM
+  if (envs_.empty()) return true;
+  // store to base register of the INV instruction that made the call
+  auto inst = PtrCast<RegInst>(rom_.data() + pc_ - 4);
+  auto base = envs_.top()->reg_base;
+  if constexpr (kChecked) {
+    if (base + inst->b >= reg_top_) return PrintError("invalid register");
+  }
+  regs_[base + inst->b] = val_reg_;
   return true;
 }
 
-bool VM::IonInput(ValueStack &vals, Value &ret) {
+bool VM::IonPrint(const Value *args, std::uint32_t arg_count,
+                  Value &ret) {
+  if (arg_count != 1) return false;
+  PrintValue(args[0]);
+  ret = args[0];
+  return true;
+}
+
+bool VM::IonInput(const Value *args, std::uint32_t arg_count,
+                  Value &ret) {
+  if (arg_count) return false;
   std::cin >> ret.value;
   ret.env = nullptr;
   return true;
 }
 
-bool VM::IonIf(ValueStack &vals, Value &ret) {
-  if (vals.size() < 3) return false;
-  // fetch condition
-  if (vals.top().env) return false;
-  auto cond = vals.top().value != 0;
-  vals.pop();
-  // fetch true part
-  auto then = vals.top();
-  vals.pop();
-  // fetch false part
-  auto else_then = vals.top();
-  vals.pop();
-  // tail call corresponding part
-  auto result = DoTailCall(cond ? then : else_then);
-  if (result) {
-    auto env = MakeEnv();
-    env->ret_pc = pc_;
-    envs_.push(env);
-  }
-  return result;
+bool VM::IonIf(const Value *args, std::uint32_t arg_count, Value &ret) {
+  if (arg_count != 3) return false;
+  // check condition
+  if (args[0].env) return false;
+  // return corresponding part, it will be called in place of '?'
+  ret = args[0].value ? args[1] : args[2];
+  ext_tail_call_ = true;
+  return true;
 }
 
-bool VM::IonIs(ValueStack &vals, Value &ret) {
-  if (vals.size() < 2) return false;
-  // fetch arguments
-  auto lhs = vals.top();
-  vals.pop();
-  auto rhs = vals.top();
-  vals.pop();
+bool VM::IonIs(const Value *args, std::uint32_t arg_count, Value &ret) {
+  if (arg_count != 2) return false;
   // check if lhs and rhs are same
+  const auto &lhs = args[0], &rhs = args[1];
   if ((lhs.env && rhs.env) || (!lhs.env && !rhs.env)) {
     ret.value = lhs.value == rhs.value;
   }
@@ -195,17 +445,18 @@ bool VM::IonIs(ValueStack &vals, Value &ret) {
   return true;
 }
 
-bool VM::IonCalcOp(ValueStack &vals, Value &ret, Operator op) {
+bool VM::IonCalcOp(const Value *args, std::uint32_t arg_count, Value &ret,
+                   Operator op) {
   std::int32_t lhs, rhs;
+  auto is_unary = op == Operator::Not || op == Operator::LogicNot;
+  if (arg_count != (is_unary ? 1 : 2)) return false;
   // fetch lhs
-  if (vals.top().env) return false;
-  lhs = vals.top().value;
-  vals.pop();
+  if (args[0].env) return false;
+  lhs = args[0].value;
   // fetch rhs
-  if (op != Operator::Not && op != Operator::LogicNot) {
-    if (vals.top().env) return false;
-    rhs = vals.top().value;
-    vals.pop();
+  if (!is_unary) {
+    if (args[1].env) return false;
+    rhs = args[1].value;
   }
   // calculate
   switch (op) {
@@ -241,29 +492,82 @@ bool VM::LoadProgram(const std::string &file) {
   std::ifstream ifs(file, std::ios::binary);
   if (!ifs.is_open()) return false;
   // read bytes
-  std::vector<std::uint8_t> buffer;
-  unsigned cur_byte = ifs.get();
-  while (cur_byte != std::char_traits<unsigned char>::eof()) {
-    buffer.push_back(cur_byte);
-    cur_byte = ifs.get();
-  }
+  std::vector<std::uint8_t> buffer(std::istreambuf_iterator<char>(ifs),
+                                   {});
   return LoadProgram(buffer);
 }
 
 bool VM::LoadProgram(const std::vector<std::uint8_t> &buffer) {
-  auto pos = CodeGen::ParseBytecode(buffer, sym_table_, pc_table_,
-                                    global_funcs_);
-  if (pos < 0) return false;
-  // copy bytecode segment
-  rom_.reserve(buffer.size() - pos);
-  for (std::size_t i = pos; i < buffer.size(); ++i) {
-    rom_.push_back(buffer[i]);
+  Program program;
+  if (!CodeGen::ParseBytecode(buffer, program)) return false;
+  return LoadProgram(std::move(program));
+}
+
+bool VM::LoadProgram(Program program) {
+  // verify all code before loading
+  Verifier verifier(program.mode, program.insts, program.sym_table.size(),
+                    program.pc_table, program.func_infos);
+  if (!verifier.VerifyEntry(0, program.main_slots) ||
+      !verifier.VerifyFuncs(0)) {
+    return false;
   }
+  mode_ = program.mode;
+  main_slots_ = program.main_slots;
+  sym_table_ = std::move(program.sym_table);
+  pc_table_ = std::move(program.pc_table);
+  func_infos_ = std::move(program.func_infos);
+  global_funcs_ = std::move(program.global_funcs);
+  rom_ = std::move(program.insts);
+  // allocate slots of top level frame
+  InitRootFrame();
   // set up external functions (Ionia standard functions)
   InitExtFuncs();
   return true;
 }
 
+bool VM::AppendProgram(const CodeGen &gen, std::uint32_t entry) {
+  // verify new code before appending, previous code is never changed
+  Verifier verifier(gen.mode(), gen.insts(), gen.sym_table().size(),
+                    gen.pc_table(), gen.func_infos());
+  if (!verifier.VerifyEntry(entry, gen.main_slots()) ||
+      !verifier.VerifyFuncs(pc_table_.size())) {
+    return false;
+  }
+  // append new symbols, functions and code,
+  // previous ones are never changed by code generator
+  const auto &syms = gen.sym_table();
+  for (auto i = sym_table_.size(); i < syms.size(); ++i) {
+    sym_table_.Intern(syms[i]);
+  }
+  const auto &pcs = gen.pc_table();
+  pc_table_.insert(pc_table_.end(), pcs.begin() + pc_table_.size(),
+                   pcs.end());
+  const auto &infos = gen.func_infos();
+  func_infos_.insert(func_infos_.end(),
+                     infos.begin() + func_infos_.size(), infos.end());
+  for (const auto &it : gen.global_funcs()) {
+    global_funcs_[sym_table_[it.first]] = it.second;
+  }
+  const auto &insts = gen.insts();
+  rom_.insert(rom_.end(), insts.begin() + rom_.size(), insts.end());
+  // set up external functions that used by new code
+  mode_ = gen.mode();
+  main_slots_ = gen.main_slots();
+  if (ext_) {
+    AddStdFuncs();
+  }
+  else {
+    InitExtFuncs();
+  }
+  // reset status, but keep global variables in root environment
+  pc_ = entry;
+  vals_.clear();
+  while (!envs_.empty()) envs_.pop();
+  InitRootFrame();
+  envs_.push(root_);
+  return true;
+}
+
 bool VM::RegisterFunction(const std::string &name, ExtFunc func) {
   Value ret;
   return RegisterFunction(name, func, ret);
@@ -271,24 +575,21 @@ bool VM::RegisterFunction(const std::string &name, ExtFunc func) {
 
 bool VM::RegisterFunction(const std::string &name, ExtFunc func,
                           Value &ret) {
-  for (std::size_t i = 0; i < sym_table_.size(); ++i) {
-    if (sym_table_[i] == name) {
-      // get new function pc id
-      auto pc_id = pc_table_.size() + ext_funcs_.size();
-      // add func to external function table
-      ext_funcs_.insert({pc_id, func});
-      // add func to ext environment
-      ret = MakeValue(pc_id, ext_);
-      ext_->slot.insert({i, ret});
-      return true;
-    }
-  }
-  return false;
+  std::uint32_t index;
+  if (!sym_table_.Find(name, index)) return false;
+  // get new function pc id
+  auto pc_id = -1 - static_cast<std::int32_t>(ext_funcs_.size());
+  // add func to external function table
+  ext_funcs_.insert({pc_id, func});
+  // add func to ext environment
+  ret = MakeValue(pc_id, ext_);
+  ext_->slot.insert({index, ret});
+  return true;
 }
 
 void VM::RegisterAnonFunc(ExtFunc func, Value &ret) {
   // get new function pc id
-  auto pc_id = pc_table_.size() + ext_funcs_.size();
+  auto pc_id = -1 - static_cast<std::int32_t>(ext_funcs_.size());
   // add func to external function table
   ext_funcs_.insert({pc_id, func});
   // make new value and return
@@ -304,29 +605,44 @@ bool VM::CallFunction(const std::string &name,
   // check argument count
   if (args.size() != func.arg_count) return false;
   // call function
-  Value val = {static_cast<std::int32_t>(func.pc_id), MakeEnv(root_)};
+  Value val = {static_cast<std::int32_t>(func.pc_id), root_};
   return CallFunction(val, args, ret);
 }
 
 bool VM::CallFunction(const Value &func, const std::vector<Value> &args,
                       Value &ret) {
   if (!func.env) return false;
-  // set up arguments
-  for (const auto &i : args) vals_.push(i);
   // backup pc, environment stack and reset
   // since VM will automatically stop when executing RET instruction
   // and there is only one environment in environment stack
   auto last_pc = pc_;
   auto last_envs = envs_;
+  auto last_reg_top = reg_top_;
   while (!envs_.empty()) envs_.pop();
-  // call function
-  envs_.push(func.env);
-  pc_ = pc_table_[func.value];
-  auto result = Run();
+  // set up arguments and call function
+  auto frame = MakeEnv();
+  bool result;
+  if (mode_ == CodeMode::Register) {
+    // arguments are placed after registers in use
+    auto base = reg_top_;
+    if (base + args.size() > regs_.size()) {
+      regs_.resize(std::max(base + args.size(), regs_.size() * 2));
+    }
+    std::copy(args.begin(), args.end(), regs_.begin() + base);
+    result = InitRegFrame<true>(func, base, args.size(), base, frame);
+  }
+  else {
+    // the last argument is on the top of stack
+    vals_.insert(vals_.end(), args.begin(), args.end());
+    result = InitFrame<true>(func, args.size(), frame);
+  }
+  envs_.push(std::move(frame));
+  if (result) result = Run();
   if (result) ret = val_reg_;
   // restore last status
   pc_ = last_pc;
   envs_ = last_envs;
+  reg_top_ = last_reg_top;
   return result;
 }
 
@@ -334,42 +650,167 @@ void VM::Reset() {
   pc_ = 0;
   val_reg_ = {0, nullptr};
   // clear stacks
-  while (!vals_.empty()) vals_.pop();
+  vals_.clear();
   while (!envs_.empty()) envs_.pop();
   // create root environment
   root_ = MakeEnv(ext_);
+  InitRootFrame();
   envs_.push(root_);
 }
 
+void VM::InitRootFrame() {
+  // top level frame always starts at the bottom of register file
+  root_->locals.assign(main_slots_, {0, nullptr});
+  regs_.assign(main_slots_, {0, nullptr});
+  reg_top_ = main_slots_;
+}
+
 bool VM::Run() {
-#define VM_NEXT(len)                          \
-  do {                                        \
-    pc_ += len;                               \
-    inst = PtrCast<Inst>(rom_.data() + pc_);  \
-    goto *inst_labels[inst->opcode];          \
+  switch (flavor_) {
+    // all loaded code has been verified
+    case Flavor::Fast: return RunWith<FastPolicy>();
+    case Flavor::Checked: return RunWith<CheckedPolicy>();
+    case Flavor::Profiled: {
+      inst_counts_.fill(0);
+      auto ret = RunWith<ProfiledPolicy>();
+      PrintProfile();
+      return ret;
+    }
+    case Flavor::Traced: return RunWith<TracedPolicy>();
+    default: assert(false); return false;
+  }
+}
+
+bool VM::IsValidInst(std::uint32_t pc) const {
+  if (pc >= rom_.size()) return false;
+  auto left = rom_.size() - pc;
+  if (mode_ == CodeMode::Register) {
+    if (left < 4) return false;
+    auto opcode = PtrCast<RegInst>(rom_.data() + pc)->opcode;
+    if (opcode >= kRegInstCount) return false;
+    return !IsLongRegInst(static_cast<RegOpCode>(opcode)) || left >= 8;
+  }
+  Inst inst = {0, 0};
+  std::memcpy(&inst, rom_.data() + pc, left < 4 ? left : 4);
+  if (inst.opcode >= kInstCount) return false;
+  return IsShortInst(static_cast<OpCode>(inst.opcode)) || left >= 4;
+}
+
+template <typename Policy>
+bool VM::RunWith() {
+  return mode_ == CodeMode::Register ? RunRegister<Policy>()
+                                     : RunStack<Policy>();
+}
+
+void VM::TraceInst() {
+  auto opcode = mode_ == CodeMode::Register
+                    ? PtrCast<RegInst>(rom_.data() + pc_)->opcode
+                    : rom_[pc_] & VM_INST_OPCODE_MASK;
+  std::cerr << "[TRACE] pc = ";
+  std::cerr << std::hex << std::setw(8) << std::setfill('0') << pc_;
+  std::cerr << ", " << GetInstName(mode_, opcode) << ", stack = ";
+  std::cerr << std::dec << vals_.size() << ", frames = " << envs_.size();
+  std::cerr << std::endl;
+}
+
+void VM::PrintProfile() {
+  // sort opcodes by execution count
+  std::vector<std::uint32_t> opcodes;
+  std::uint64_t total = 0;
+  for (std::uint32_t i = 0; i < inst_counts_.size(); ++i) {
+    if (!inst_counts_[i]) continue;
+    opcodes.push_back(i);
+    total += inst_counts_[i];
+  }
+  std::sort(opcodes.begin(), opcodes.end(),
+            [this](std::uint32_t l, std::uint32_t r) {
+              return inst_counts_[l] > inst_counts_[r];
+            });
+  // print profile
+  std::cerr << "[PROFILE] " << std::dec << total;
+  std::cerr << " instructions executed" << std::endl;
+  for (const auto &i : opcodes) {
+    std::cerr << "  " << std::left << std::setw(6) << std::setfill(' ');
+    std::cerr << GetInstName(mode_, i) << std::right << std::setw(14);
+    std::cerr << inst_counts_[i] << std::setw(8) << std::fixed;
+    std::cerr << std::setprecision(2) << 100.0 * inst_counts_[i] / total;
+    std::cerr << "%" << std::endl;
+  }
+}
+
+void VM::PrintValue(const Value &value) {
+  if (value.env) {
+    std::cout << "<function at: 0x";
+    std::cout << std::hex << std::setw(8) << std::setfill('0');
+    std::cout << value.value << ">" << std::endl;
+  }
+  else {
+    std::cout << std::dec << value.value << std::endl;
+  }
+}
+
+// hooks of profiled & traced flavor, called before dispatching
+#define VM_DISPATCH_HOOK(opcode)                            \
+  do {                                                      \
+    if constexpr (Policy::kProfile) ++inst_counts_[opcode]; \
+    if constexpr (Policy::kTrace) TraceInst();              \
   } while (0)
 
+template <typename Policy>
+bool VM::RunStack() {
+#define VM_NEXT(len)                                    \
+  do {                                                  \
+    pc_ += len;                                         \
+    if constexpr (kChecked) {                           \
+      if (!IsValidInst(pc_)) {                          \
+        return PrintError("invalid instruction");       \
+      }                                                 \
+    }                                                   \
+    inst = PtrCast<Inst>(rom_.data() + pc_);            \
+    opcode = rom_[pc_] & VM_INST_OPCODE_MASK;           \
+    VM_DISPATCH_HOOK(opcode);                           \
+    goto *inst_labels[opcode];                          \
+  } while (0)
+
+  constexpr bool kChecked = Policy::kChecked;
   Inst *inst;
+  std::uint32_t opcode;
   const void *inst_labels[] = { VM_INST_ALL(VM_EXPAND_LABEL_LIST) };
   // fetch first instruction
   VM_NEXT(0);
 
   // get value of identifier from environment
   VM_LABEL(GET) {
-    if (!GetEnvValue(inst, val_reg_)) return false;
+    if (!GetEnvValue(inst->opr, val_reg_)) return false;
     VM_NEXT(4);
   }
 
-  // set value of identifier in current environment
+  // set value of identifier in global environment
   VM_LABEL(SET) {
-    envs_.top()->slot[inst->opr] = val_reg_;
+    root_->slot[inst->opr] = val_reg_;
     VM_NEXT(4);
   }
 
-  // set value register as a function
+  // make closure by popping captured values from value stack
   VM_LABEL(FUN) {
-    val_reg_.env = envs_.top();
-    VM_NEXT(1);
+    if (!inst->opr) {
+      // closed function, just share the root environment
+      val_reg_.env = root_;
+      VM_NEXT(4);
+    }
+    if constexpr (kChecked) {
+      if (vals_.size() < inst->opr) {
+        return PrintError("pop from empty stack");
+      }
+    }
+    auto closure = MakeEnv();
+    closure->locals.resize(inst->opr);
+    for (auto i = inst->opr; i; --i) {
+      closure->locals[i - 1] = std::move(vals_.back());
+      vals_.pop_back();
+    }
+    val_reg_.env = std::move(closure);
+    VM_NEXT(4);
   }
 
   // put constant number to value register
@@ -393,20 +834,18 @@ bool VM::Run() {
 
   // push value register into value stack
   VM_LABEL(PUSH) {
-    vals_.push(val_reg_);
+    vals_.push_back(val_reg_);
     VM_NEXT(1);
   }
 
   // pop value in value stack to value register
   VM_LABEL(POP) {
-    if (vals_.empty()) {
-      return PrintError("pop from empty stack");
-    }
-    else {
-      val_reg_ = vals_.top();
-      vals_.pop();
-      VM_NEXT(1);
+    if constexpr (kChecked) {
+      if (vals_.empty()) return PrintError("pop from empty stack");
     }
+    val_reg_ = vals_.back();
+    vals_.pop_back();
+    VM_NEXT(1);
   }
 
   // return from function
@@ -424,17 +863,299 @@ bool VM::Run() {
 
   // call function and create new environment
   VM_LABEL(CALL) {
-    if (!DoCall(val_reg_)) return false;
+    if (!DoCall<kChecked>(val_reg_, inst->opr)) return false;
     VM_NEXT(0);
   }
 
   // tail call function and modify outer environment
   VM_LABEL(TCAL) {
-    if (!DoTailCall(val_reg_)) return false;
+    if (!DoTailCall<kChecked>(val_reg_, inst->opr)) return false;
+    // return from root environment, exit from VM
+    if (envs_.empty()) return true;
+    VM_NEXT(0);
+  }
+
+  // call known closed function directly
+  VM_LABEL(DCAL) {
+    if (!DoDirectCall<kChecked>(inst->opr)) return false;
+    VM_NEXT(0);
+  }
+
+  // tail call known closed function directly
+  VM_LABEL(DTCL) {
+    if (!DoDirectTailCall<kChecked>(inst->opr)) return false;
+    VM_NEXT(0);
+  }
+
+  // get value of local slot in current frame
+  VM_LABEL(GETL) {
+    const auto &locals = envs_.top()->locals;
+    if constexpr (kChecked) {
+      if (inst->opr >= locals.size()) {
+        return PrintError("invalid local slot");
+      }
+    }
+    val_reg_ = locals[inst->opr];
+    VM_NEXT(4);
+  }
+
+  // set value of local slot in current frame
+  VM_LABEL(SETL) {
+    auto &locals = envs_.top()->locals;
+    if constexpr (kChecked) {
+      if (inst->opr >= locals.size()) {
+        return PrintError("invalid local slot");
+      }
+    }
+    locals[inst->opr] = val_reg_;
+    VM_NEXT(4);
+  }
+
+  // get captured value from closure of current function
+  VM_LABEL(GETC) {
+    const auto &closure = envs_.top()->outer;
+    if (!closure || inst->opr >= closure->locals.size()) {
+      return PrintError("invalid captured value");
+    }
+    val_reg_ = closure->locals[inst->opr];
+    VM_NEXT(4);
+  }
+
+  // put value of local slot into a new box
+  VM_LABEL(BOX) {
+    auto &locals = envs_.top()->locals;
+    if constexpr (kChecked) {
+      if (inst->opr >= locals.size()) {
+        return PrintError("invalid local slot");
+      }
+    }
+    auto box = MakeEnv();
+    box->locals.push_back(std::move(locals[inst->opr]));
+    locals[inst->opr] = {0, std::move(box)};
+    VM_NEXT(4);
+  }
+
+  // get value in box
+  VM_LABEL(UNBX) {
+    if (!val_reg_.env || val_reg_.env->locals.size() != 1) {
+      return PrintError("invalid box");
+    }
+    auto val = val_reg_.env->locals.front();
+    val_reg_ = std::move(val);
+    VM_NEXT(1);
+  }
+
+  // set value in box of local slot in current frame
+  VM_LABEL(SETB) {
+    const auto &locals = envs_.top()->locals;
+    if constexpr (kChecked) {
+      if (inst->opr >= locals.size()) {
+        return PrintError("invalid local slot");
+      }
+    }
+    const auto &box = locals[inst->opr].env;
+    if (!box || box->locals.size() != 1) {
+      return PrintError("invalid box");
+    }
+    box->locals.front() = val_reg_;
+    VM_NEXT(4);
+  }
+
+#undef VM_NEXT
+}
+
+template <typename Policy>
+bool VM::RunRegister() {
+#define VM_NEXT(len)                                    \
+  do {                                                  \
+    pc_ += len;                                         \
+    if constexpr (kChecked) {                           \
+      if (!IsValidInst(pc_)) {                          \
+        return PrintError("invalid instruction");       \
+      }                                                 \
+    }                                                   \
+    inst = PtrCast<RegInst>(rom_.data() + pc_);         \
+    VM_DISPATCH_HOOK(inst->opcode);                     \
+    goto *inst_labels[inst->opcode];                    \
+  } while (0)
+#define VM_WORD() (*IntPtrCast<32>(rom_.data() + pc_ + 4))
+#define VM_CHECK_REG(r)                                   \
+  do {                                                    \
+    if constexpr (kChecked) {                             \
+      if ((r) >= reg_count) {                             \
+        return PrintError("invalid register");            \
+      }                                                   \
+    }                                                     \
+  } while (0)
+#define VM_LOAD_FRAME()                                   \
+  do {                                                    \
+    auto base = envs_.top()->reg_base;                    \
+    regs = regs_.data() + base;                           \
+    reg_count = reg_top_ - base;                          \
+  } while (0)
+
+  constexpr bool kChecked = Policy::kChecked;
+  RegInst *inst;
+  const void *inst_labels[] = { VM_REG_INST_ALL(VM_EXPAND_LABEL_LIST) };
+  // registers of current frame, reloaded after switching frames
+  Value *regs;
+  std::uint32_t reg_count;
+  VM_LOAD_FRAME();
+  // fetch first instruction
+  VM_NEXT(0);
+
+  // copy value between registers
+  VM_LABEL(MOV) {
+    VM_CHECK_REG(inst->a);
+    VM_CHECK_REG(inst->b);
+    regs[inst->a] = regs[inst->b];
+    VM_NEXT(4);
+  }
+
+  // load 16-bit signed immediate number to register
+  VM_LABEL(LDI) {
+    VM_CHECK_REG(inst->a);
+    auto imm = static_cast<std::int16_t>(inst->b | (inst->c << 8));
+    regs[inst->a] = MakeValue(imm);
+    VM_NEXT(4);
+  }
+
+  // load 32-bit constant number to register
+  VM_LABEL(LDK) {
+    VM_CHECK_REG(inst->a);
+    regs[inst->a] = MakeValue(static_cast<std::int32_t>(VM_WORD()));
+    VM_NEXT(8);
+  }
+
+  // load value of identifier in global environment to register
+  VM_LABEL(LDG) {
+    VM_CHECK_REG(inst->a);
+    if (!GetEnvValue(VM_WORD(), regs[inst->a])) return false;
+    VM_NEXT(8);
+  }
+
+  // store register to identifier in global environment
+  VM_LABEL(STG) {
+    VM_CHECK_REG(inst->a);
+    root_->slot[VM_WORD()] = regs[inst->a];
+    VM_NEXT(8);
+  }
+
+  // load captured value from closure of current function
+  VM_LABEL(LDC) {
+    VM_CHECK_REG(inst->a);
+    const auto &closure = envs_.top()->outer;
+    std::size_t index = inst->b | (inst->c << 8);
+    if (!closure || index >= closure->locals.size()) {
+      return PrintError("invalid captured value");
+    }
+    regs[inst->a] = closure->locals[index];
+    VM_NEXT(4);
+  }
+
+  // put value of register into a new box
+  VM_LABEL(MKB) {
+    VM_CHECK_REG(inst->a);
+    auto box = MakeEnv();
+    box->locals.push_back(std::move(regs[inst->a]));
+    regs[inst->a] = {0, std::move(box)};
+    VM_NEXT(4);
+  }
+
+  // load value in box to register
+  VM_LABEL(LDB) {
+    VM_CHECK_REG(inst->a);
+    VM_CHECK_REG(inst->b);
+    const auto &box = regs[inst->b].env;
+    if (!box || box->locals.size() != 1) {
+      return PrintError("invalid box");
+    }
+    auto val = box->locals.front();
+    regs[inst->a] = std::move(val);
+    VM_NEXT(4);
+  }
+
+  // store value of register to box
+  VM_LABEL(STB) {
+    VM_CHECK_REG(inst->a);
+    VM_CHECK_REG(inst->b);
+    const auto &box = regs[inst->a].env;
+    if (!box || box->locals.size() != 1) {
+      return PrintError("invalid box");
+    }
+    box->locals.front() = regs[inst->b];
+    VM_NEXT(4);
+  }
+
+  // make closure by copying captured values from registers
+  VM_LABEL(CLOS) {
+    VM_CHECK_REG(inst->a);
+    auto pc_id = static_cast<std::int32_t>(VM_WORD());
+    if (!inst->c) {
+      // closed function, just share the root environment
+      regs[inst->a] = MakeValue(pc_id, root_);
+      VM_NEXT(8);
+    }
+    if constexpr (kChecked) {
+      if (static_cast<std::uint32_t>(inst->b + inst->c) > reg_count) {
+        return PrintError("invalid register");
+      }
+    }
+    auto closure = MakeEnv();
+    closure->locals.assign(regs + inst->b, regs + inst->b + inst->c);
+    regs[inst->a] = {pc_id, std::move(closure)};
+    VM_NEXT(8);
+  }
+
+  // call function and create new environment
+  VM_LABEL(INV) {
+    if (!DoRegCall<kChecked>(inst)) return false;
+    VM_LOAD_FRAME();
+    VM_NEXT(0);
+  }
+
+  // tail call function and modify current environment
+  VM_LABEL(TINV) {
+    if (!DoRegTailCall<kChecked>(inst)) return false;
     // return from root environment, exit from VM
     if (envs_.empty()) return true;
+    VM_LOAD_FRAME();
+    VM_NEXT(0);
+  }
+
+  // return from function
+  VM_LABEL(RTN) {
+    VM_CHECK_REG(inst->a);
+    val_reg_ = regs[inst->a];
+    if (envs_.size() > 1) {
+      if (!DoRegReturn<kChecked>()) return false;
+      VM_LOAD_FRAME();
+      VM_NEXT(0);
+    }
+    else {
+      // return from root environment, exit from VM
+      return true;
+    }
+  }
+
+  // call known closed function directly
+  VM_LABEL(DINV) {
+    if (!DoRegDirectCall<kChecked>(inst)) return false;
+    VM_LOAD_FRAME();
     VM_NEXT(0);
   }
 
+  // tail call known closed function directly
+  VM_LABEL(DTIV) {
+    if (!DoRegDirectTailCall<kChecked>(inst)) return false;
+    VM_LOAD_FRAME();
+    VM_NEXT(0);
+  }
+
+#undef VM_LOAD_FRAME
+#undef VM_CHECK_REG
+#undef VM_WORD
 #undef VM_NEXT
 }
+
+#undef VM_DISPATCH_HOOK
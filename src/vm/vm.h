@@ -5,25 +5,48 @@
 #include <vector>
 #include <stack>
 #include <unordered_map>
+#include <array>
 #include <cstdint>
 
 #include "vm/define.h"
 
 namespace ionia::vm {
 
+class CodeGen;
+
 class VM {
  public:
-  // definition of value stack
-  using ValueStack = std::stack<Value>;
-  // definition of external function
-  using ExtFunc = std::function<bool(ValueStack &, Value &)>;
+  // definition of external function, arguments are passed in order,
+  // and they are only valid until the VM is entered again
+  using ExtFunc =
+      std::function<bool(const Value *, std::uint32_t, Value &)>;
   // definition of symbol error handler
   using ErrorHandler = std::function<bool(const std::string &, Value &)>;
 
-  VM() { Reset(); }
+  // flavors of dispatch loop, each one is a separate specialization
+  //  Fast:     skip checks of bytecode that proved by verifier
+  //  Checked:  always check bytecode at runtime
+  //  Profiled: count executed instructions, print profile after running
+  //  Traced:   print each executed instruction
+  enum class Flavor { Fast, Checked, Profiled, Traced };
+
+  VM()
+      : mode_(CodeMode::Stack), main_slots_(0), flavor_(Flavor::Fast),
+        ext_tail_call_(false) {
+    Reset();
+  }
 
   bool LoadProgram(const std::string &file);
   bool LoadProgram(const std::vector<std::uint8_t> &buffer);
+  // load in-memory program, tables and instructions are moved into VM
+  // programs are verified before loading, returns false if failed,
+  // so loaded code can be run without runtime checks of bytecode
+  bool LoadProgram(Program program);
+  // append code that generated by 'gen' after the last appending to
+  // current program, all previous code, tables and global variables
+  // are kept, and the next 'Run' will start from 'entry'
+  // new code is verified before appending, returns false if failed
+  bool AppendProgram(const CodeGen &gen, std::uint32_t entry);
 
   // register an external function
   bool RegisterFunction(const std::string &name, ExtFunc func);
@@ -44,12 +67,20 @@ class VM {
   void Reset();
   // run current program
   bool Run();
+  // print value to standard output
+  void PrintValue(const Value &value);
+
+  // getters
+  // value of the last executed expression
+  const Value &val_reg() const { return val_reg_; }
 
   // setters
   // set handler that will be called when a symbol error occurs
   void set_sym_error_handler(ErrorHandler handler) {
     sym_error_handler_ = handler;
   }
+  // set flavor of dispatch loop
+  void set_flavor(Flavor flavor) { flavor_ = flavor; }
 
  private:
   // supported operators by Ionia VM
@@ -65,42 +96,132 @@ class VM {
   bool PrintError(const char *message, const char *symbol);
 
   // initialize external function table
-  // add all Ionia standard functions, like 'is', '?', 'eq', '+'...
   void InitExtFuncs();
-  // get value from current environment, return false if not found
-  bool GetEnvValue(Inst *inst, Value &value);
+  // add all Ionia standard functions that used by program and
+  // have not been added, like 'is', '?', 'eq', '+'...
+  void AddStdFuncs();
+  // get value from global environment, return false if not found
+  bool GetEnvValue(std::uint32_t sym, Value &value);
+  // allocate slots of top level frame
+  void InitRootFrame();
+  // functions with template parameter 'kChecked' skip checks that
+  // have been proved by verifier if it is not set
+
+  // set up frame of a VM function and move arguments into it
+  template <bool kChecked>
+  bool InitFrame(const Value &func, std::uint32_t arg_count,
+                 const EnvPtr &frame);
+  // enter function 'pc_id' without checking argument count
+  template <bool kChecked>
+  bool EnterFrame(std::uint32_t pc_id, const EnvPtr &outer,
+                  const EnvPtr &frame);
 
   // call a VM function
-  bool DoCall(const Value &func);
+  template <bool kChecked>
+  bool DoCall(const Value &func, std::uint32_t arg_count);
   // tail call a VM function
-  bool DoTailCall(const Value &func);
+  template <bool kChecked>
+  bool DoTailCall(const Value &func, std::uint32_t arg_count);
+  // call/tail call a known closed function by DCAL/DTCL instruction
+  template <bool kChecked>
+  bool DoDirectCall(std::uint32_t pc_id);
+  template <bool kChecked>
+  bool DoDirectTailCall(std::uint32_t pc_id);
+  // call external function with arguments in value stack
+  bool DoExtCall(const ExtFunc &func, std::uint32_t arg_count);
+
+  // set up frame of a VM function at 'base' of register file,
+  // and copy arguments from register 'args'
+  template <bool kChecked>
+  bool InitRegFrame(const Value &func, std::uint32_t args,
+                    std::uint32_t arg_count, std::uint32_t base,
+                    const EnvPtr &frame);
+  // enter function 'pc_id' without checking argument count
+  void EnterRegFrame(std::uint32_t pc_id, const EnvPtr &outer,
+                     std::uint32_t args, std::uint32_t base,
+                     const EnvPtr &frame);
+  // call/tail call function with arguments in register file,
+  // result of non-tail call is stored to register 'args' after returning
+  template <bool kChecked>
+  bool DoRegCallFunc(const Value &func, std::uint32_t args,
+                     std::uint32_t arg_count, bool is_tail);
+  // call function by INV instruction
+  template <bool kChecked>
+  bool DoRegCall(const RegInst *inst);
+  // tail call function by TINV instruction
+  template <bool kChecked>
+  bool DoRegTailCall(const RegInst *inst);
+  // call/tail call a known closed function by DINV/DTIV instruction
+  template <bool kChecked>
+  bool DoRegDirectCall(const RegInst *inst);
+  template <bool kChecked>
+  bool DoRegDirectTailCall(const RegInst *inst);
+  // return from current frame and store value register to caller
+  template <bool kChecked>
+  bool DoRegReturn();
+
+  // run program with dispatch loop specialized by 'Policy'
+  template <typename Policy>
+  bool RunWith();
+  // run program in stack-based mode
+  template <typename Policy>
+  bool RunStack();
+  // run program in register-based mode
+  template <typename Policy>
+  bool RunRegister();
+  // check if there is a complete instruction at 'pc',
+  // used by checked flavor
+  bool IsValidInst(std::uint32_t pc) const;
+  // print instruction at current pc, used by traced flavor
+  void TraceInst();
+  // print execution count of instructions, used by profiled flavor
+  void PrintProfile();
 
   // bind member functions to external function
   template <typename Func, typename... Args>
   void BindExtFunc(const std::string &name, Func func, Args... args) {
     using namespace std::placeholders;
-    RegisterFunction(name, std::bind(func, this, _1, _2, args...));
+    // skip if already added
+    std::uint32_t index;
+    if (sym_table_.Find(name, index) && ext_->slot.count(index)) return;
+    RegisterFunction(name, std::bind(func, this, _1, _2, _3, args...));
   }
 
   // Ionia standard fucntions
-  bool IonPrint(ValueStack &vals, Value &ret);
-  bool IonInput(ValueStack &vals, Value &ret);
-  bool IonIf(ValueStack &vals, Value &ret);
-  bool IonIs(ValueStack &vals, Value &ret);
-  bool IonCalcOp(ValueStack &vals, Value &ret, Operator op);
+  bool IonPrint(const Value *args, std::uint32_t arg_count, Value &ret);
+  bool IonInput(const Value *args, std::uint32_t arg_count, Value &ret);
+  bool IonIf(const Value *args, std::uint32_t arg_count, Value &ret);
+  bool IonIs(const Value *args, std::uint32_t arg_count, Value &ret);
+  bool IonCalcOp(const Value *args, std::uint32_t arg_count, Value &ret,
+                 Operator op);
 
   std::vector<std::uint8_t> rom_;
+  // mode of loaded bytecode & slot count of top level frame
+  CodeMode mode_;
+  std::uint32_t main_slots_;
+  // flavor of dispatch loop & execution count of each opcode
+  Flavor flavor_;
+  std::array<std::uint64_t, 256> inst_counts_;
   // internal status
   std::uint32_t pc_;
   Value val_reg_;
-  ValueStack vals_;
+  std::vector<Value> vals_;
   std::stack<EnvPtr> envs_;
+  // register file of register-based VM, and end of current frame
+  std::vector<Value> regs_;
+  std::uint32_t reg_top_;
+  // set if external function returns a function that should be
+  // called with no arguments in place of it (like '?')
+  bool ext_tail_call_;
   EnvPtr root_, ext_;
   // tables
   SymbolTable sym_table_;
   FuncPCTable pc_table_;
+  FuncInfoTable func_infos_;
   GlobalFuncTable global_funcs_;
-  std::unordered_map<std::uint32_t, ExtFunc> ext_funcs_;
+  // external functions, indexed by negative function ids,
+  // so they never conflict with functions of appended code
+  std::unordered_map<std::int32_t, ExtFunc> ext_funcs_;
   // symbol error handler
   ErrorHandler sym_error_handler_;
 };